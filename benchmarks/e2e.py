@@ -0,0 +1,280 @@
+r''' End-to-end benchmark of :func:`mesh2sdf.compute`.
+
+Runs every combination of mesh, size and mode, each in a fresh process so that
+the peak RSS belongs to that run alone, and records the wall time, the time of
+each stage, the peak RSS and the bytes that went through the disk-backed grids.
+The results can be saved as a baseline and later runs compared against it:
+
+  python benchmarks/e2e.py --quick --save-baseline benchmarks/baseline.json
+  python benchmarks/e2e.py --quick --baseline benchmarks/baseline.json
+
+The exit status is 1 if any case got slower (or bigger) than the baseline by more
+than the threshold.
+'''
+
+import argparse
+import json
+import os
+import platform
+import resource
+import subprocess
+import sys
+import time
+
+import numpy as np
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+PLANE = os.path.join(ROOT, 'example', 'data', 'plane.obj')
+
+MESHES = ['plane', 'sphere_1k', 'sphere_10k', 'sphere_100k', 'sphere_1m',
+          'sphere_10m']
+SIZES = [64, 128, 256, 512, 1024]
+MODES = ['plain', 'fix']
+QUICK = dict(meshes=['plane', 'sphere_1k', 'sphere_100k'], sizes=[64, 128],
+             modes=MODES)
+
+# the measurements compared against the baseline, with how much worse counts as a
+# regression relative to --threshold (the disk bytes are exact, so any growth is),
+# and a difference too small to count whatever the ratio, so that timer noise on
+# the smallest cases is not taken for a regression
+METRICS = {'wall_s': (1.0, 0.05), 'peak_rss_mb': (1.0, 4.0), 'disk_bytes': (0.0, 0)}
+
+
+def bumpy_sphere(n_faces: int):
+  r''' A closed latitude-longitude sphere with about n_faces triangles, with bumps
+  so that its distance field is not trivially radial, inside [-0.9, 0.9]^3.
+  '''
+  rings = max(2, int(round(np.sqrt(n_faces / 4.0))))
+  segments = 2 * rings
+  theta = np.pi * np.arange(1, rings) / rings
+  phi = 2 * np.pi * np.arange(segments) / segments
+  t, p = np.meshgrid(theta, phi, indexing='ij')
+  r = 0.8 * (1 + 0.1 * np.sin(5 * t) * np.sin(5 * p))
+  ring_vertices = np.stack([r * np.sin(t) * np.cos(p), r * np.sin(t) * np.sin(p),
+                            r * np.cos(t)], axis=-1).reshape(-1, 3)
+  vertices = np.concatenate([[[0, 0, 0.8]], ring_vertices, [[0, 0, -0.8]]])
+  south = len(vertices) - 1
+
+  def ring(i, s):
+    return 1 + (i - 1) * segments + s % segments
+
+  s = np.arange(segments)
+  faces = [np.stack([np.zeros_like(s), ring(1, s), ring(1, s + 1)], axis=-1)]
+  i, s = np.meshgrid(np.arange(1, rings - 1), np.arange(segments), indexing='ij')
+  i, s = i.ravel(), s.ravel()
+  faces.append(np.stack([ring(i, s), ring(i + 1, s), ring(i + 1, s + 1)], axis=-1))
+  faces.append(np.stack([ring(i, s), ring(i + 1, s + 1), ring(i, s + 1)], axis=-1))
+  s = np.arange(segments)
+  faces.append(np.stack([ring(rings - 1, s), np.full_like(s, south),
+                         ring(rings - 1, s + 1)], axis=-1))
+  return vertices.astype(np.float32), np.concatenate(faces).astype(np.int32)
+
+
+def load_mesh(name: str):
+  r''' The vertices (normalized into [-0.8, 0.8] like example/test.py) and faces
+  of the named benchmark mesh.
+  '''
+  if name == 'plane':
+    import trimesh
+    mesh = trimesh.load(PLANE, force='mesh')
+    vertices = mesh.vertices
+    bbmin, bbmax = vertices.min(0), vertices.max(0)
+    scale = 2.0 * 0.8 / (bbmax - bbmin).max()
+    vertices = (vertices - (bbmin + bbmax) * 0.5) * scale
+    return vertices.astype(np.float32), np.asarray(mesh.faces, dtype=np.int32)
+  count = name.split('_')[1]
+  n_faces = int(float(count[:-1]) * {'k': 1e3, 'm': 1e6}[count[-1]])
+  return bumpy_sphere(n_faces)
+
+
+def disk_write_bytes():
+  r''' The bytes this process has caused to be written to storage so far, or None
+  where /proc does not say. Pages dirtied through a mapping count as written.
+  '''
+  try:
+    with open('/proc/self/io') as f:
+      for line in f:
+        if line.startswith('write_bytes:'):
+          return int(line.split()[1])
+  except OSError:
+    pass
+  return None
+
+
+def run_case(mesh_name: str, size: int, mode: str):
+  r''' Runs one case in this process and returns its measurements. '''
+  import skimage.measure
+  import mesh2sdf
+
+  vertices, faces = load_mesh(mesh_name)
+  fix = mode == 'fix'
+
+  # time the stages of compute by wrapping what it calls
+  stages = {}
+
+  def timed(name, fn):
+    def wrapper(*args, **kwargs):
+      start = time.perf_counter()
+      try:
+        return fn(*args, **kwargs)
+      finally:
+        stages[name] = stages.get(name, 0.0) + time.perf_counter() - start
+    return wrapper
+
+  core_compute = mesh2sdf.core.compute
+  calls = []
+
+  def core(*args, **kwargs):
+    calls.append(None)
+    name = 'sdf' if len(calls) == 1 else 'sdf_fixed'
+    return timed(name, core_compute)(*args, **kwargs)
+
+  mesh2sdf.core.compute = core
+  skimage.measure.marching_cubes = timed('marching_cubes',
+                                         skimage.measure.marching_cubes)
+
+  mesh2sdf.core.disk_stats(reset=True)
+  written = disk_write_bytes()
+  start = time.perf_counter()
+  mesh2sdf.compute(vertices, faces, size, fix=fix, level=2 / size)
+  wall = time.perf_counter() - start
+  disk = mesh2sdf.core.disk_stats()
+  if written is not None:
+    written = disk_write_bytes() - written
+
+  stages['other'] = max(0.0, wall - sum(stages.values()))
+  return {
+      'mesh': mesh_name, 'faces': int(len(faces)), 'size': size, 'mode': mode,
+      'wall_s': wall, 'stages_s': stages,
+      # ru_maxrss is in kilobytes on Linux
+      'peak_rss_mb': resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024,
+      'disk_files': disk['files'], 'disk_bytes': disk['bytes'],
+      'disk_peak_bytes': disk['peak_bytes'], 'storage_write_bytes': written,
+  }
+
+
+def run_isolated(mesh_name: str, size: int, mode: str, timeout: float):
+  r''' Runs one case in a child process; returns its measurements, or a dict
+  with an `error` if it failed.
+  '''
+  cmd = [sys.executable, os.path.abspath(__file__), '--worker',
+         json.dumps([mesh_name, size, mode])]
+  case = {'mesh': mesh_name, 'size': size, 'mode': mode}
+  try:
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True, timeout=timeout)
+  except subprocess.TimeoutExpired:
+    return dict(case, error='timed out after %g s' % timeout)
+  lines = proc.stdout.strip().splitlines()
+  if proc.returncode != 0 or not lines:
+    message = proc.stderr.strip().splitlines()
+    return dict(case, error=message[-1] if message else
+                'exit status %d' % proc.returncode)
+  # compute prints progress of its own; the result is the last line
+  return json.loads(lines[-1])
+
+
+def case_key(result):
+  return '%s/%d/%s' % (result['mesh'], result['size'], result['mode'])
+
+
+def compare(results, baseline, threshold: float):
+  r''' Prints each case against the baseline and returns the regressions. '''
+  base = {case_key(r): r for r in baseline['results'] if 'error' not in r}
+  regressions = []
+  print('\n%-28s %12s %12s %8s %10s %10s %8s' % (
+      'case', 'wall_s', 'baseline', 'ratio', 'rss_mb', 'baseline', 'ratio'))
+  for r in results:
+    key = case_key(r)
+    if 'error' in r:
+      print('%-28s %s' % (key, r['error']))
+      continue
+    b = base.get(key)
+    if b is None:
+      print('%-28s %12.3f %12s %8s %10.1f' % (key, r['wall_s'], '-', '-',
+                                             r['peak_rss_mb']))
+      continue
+    flags = []
+    for metric, (scale, floor) in METRICS.items():
+      if b.get(metric) and r[metric] > b[metric] * (1 + scale * threshold) and \
+         r[metric] - b[metric] > floor:
+        flags.append('%s %+.0f%%' % (metric, 100 * (r[metric] / b[metric] - 1)))
+    print('%-28s %12.3f %12.3f %8.2f %10.1f %10.1f %8.2f  %s' % (
+        key, r['wall_s'], b['wall_s'], r['wall_s'] / b['wall_s'],
+        r['peak_rss_mb'], b['peak_rss_mb'], r['peak_rss_mb'] / b['peak_rss_mb'],
+        'REGRESSION: ' + ', '.join(flags) if flags else ''))
+    if flags:
+      regressions.append((key, flags))
+  return regressions
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0].strip(),
+                                   formatter_class=argparse.RawTextHelpFormatter)
+  parser.add_argument('--meshes', nargs='+', choices=MESHES, default=MESHES)
+  parser.add_argument('--sizes', nargs='+', type=int, default=SIZES)
+  parser.add_argument('--modes', nargs='+', choices=MODES, default=MODES)
+  parser.add_argument('--quick', action='store_true',
+                      help='a small matrix: %s' % json.dumps(QUICK))
+  parser.add_argument('--repeat', type=int, default=1,
+                      help='runs per case; the fastest is kept')
+  parser.add_argument('--timeout', type=float, default=3600,
+                      help='seconds allowed per run')
+  parser.add_argument('--output', help='write the results here as JSON')
+  parser.add_argument('--baseline', help='compare against these results')
+  parser.add_argument('--save-baseline', metavar='PATH',
+                      help='write the results here as the new baseline')
+  parser.add_argument('--threshold', type=float, default=0.1,
+                      help='relative slowdown counted as a regression')
+  parser.add_argument('--worker', help=argparse.SUPPRESS)
+  args = parser.parse_args()
+
+  if args.worker:
+    result = run_case(*json.loads(args.worker))
+    print(json.dumps(result))
+    return 0
+
+  if args.quick:
+    args.meshes, args.sizes, args.modes = \
+        QUICK['meshes'], QUICK['sizes'], QUICK['modes']
+  results = []
+  for mesh_name in args.meshes:
+    for size in args.sizes:
+      for mode in args.modes:
+        best = None
+        for _ in range(args.repeat):
+          r = run_isolated(mesh_name, size, mode, args.timeout)
+          if 'error' in r or best is None or r['wall_s'] < best['wall_s']:
+            best = r
+          if 'error' in r:
+            break
+        results.append(best)
+        if 'error' in best:
+          print('%-28s %s' % (case_key(best), best['error']), flush=True)
+        else:
+          print('%-28s %8.3f s  %8.1f MB  %6.1f MB on disk  %s' % (
+              case_key(best), best['wall_s'], best['peak_rss_mb'],
+              best['disk_bytes'] / 2**20,
+              ' '.join('%s=%.3f' % kv for kv in best['stages_s'].items())),
+              flush=True)
+
+  report = {'machine': platform.platform(), 'python': platform.python_version(),
+            'cpus': os.cpu_count(), 'time': time.strftime('%Y-%m-%dT%H:%M:%S'),
+            'results': results}
+  for path in (args.output, args.save_baseline):
+    if path:
+      with open(path, 'w') as f:
+        json.dump(report, f, indent=1)
+
+  if args.baseline:
+    with open(args.baseline) as f:
+      baseline = json.load(f)
+    regressions = compare(results, baseline, args.threshold)
+    if regressions:
+      print('\n%d regression(s) against %s' % (len(regressions), args.baseline))
+      return 1
+  return 1 if any('error' in r for r in results) else 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,350 @@
+// Microbenchmarks of the kernels of makelevelset3.cpp on synthetic meshes, printed as
+// JSON so runs on two commits can be compared. The kernels are file-local, so this
+// translation unit includes makelevelset3.cpp itself rather than linking against it.
+//
+// usage: mesh2sdf-bench [--filter <substring>] [--min-time <seconds>] [--label <text>]
+
+#include "makelevelset3.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+struct BenchMesh
+{
+   std::string name;
+   std::vector<Vec3f> x;
+   std::vector<Vec3ui> tri;
+   bool large;  // few triangles spanning the box, also rasterized over their whole boxes
+   BenchMesh() : large(false) {}
+};
+
+// a closed latitude-longitude sphere of radius 0.8 with about n_tri triangles
+static BenchMesh make_sphere(int n_tri)
+{
+   BenchMesh mesh;
+   int rings=max(2, (int)std::sqrt(n_tri/4.0)), segments=2*rings;
+   mesh.name="sphere";
+   mesh.x.push_back(Vec3f(0, 0, 0.8f));
+   for(int r=1; r<rings; ++r){
+      double theta=M_PI*r/rings;
+      for(int s=0; s<segments; ++s){
+         double phi=2*M_PI*s/segments;
+         mesh.x.push_back(Vec3f((float)(0.8*std::sin(theta)*std::cos(phi)),
+                                (float)(0.8*std::sin(theta)*std::sin(phi)), (float)(0.8*std::cos(theta))));
+      }
+   }
+   mesh.x.push_back(Vec3f(0, 0, -0.8f));
+   unsigned int south=(unsigned int)mesh.x.size()-1;
+   auto ring=[&](int r, int s){ return (unsigned int)(1+(r-1)*segments+(s+segments)%segments); };
+   for(int s=0; s<segments; ++s){
+      mesh.tri.push_back(Vec3ui(0, ring(1,s), ring(1,s+1)));
+      for(int r=1; r<rings-1; ++r){
+         mesh.tri.push_back(Vec3ui(ring(r,s), ring(r+1,s), ring(r+1,s+1)));
+         mesh.tri.push_back(Vec3ui(ring(r,s), ring(r+1,s+1), ring(r,s+1)));
+      }
+      mesh.tri.push_back(Vec3ui(ring(rings-1,s), south, ring(rings-1,s+1)));
+   }
+   return mesh;
+}
+
+static Vec3f random_point(std::mt19937 &rng, float extent)
+{
+   std::uniform_real_distribution<float> u(-extent, extent);
+   float a=u(rng), b=u(rng), c=u(rng);
+   return Vec3f(a, b, c);
+}
+
+// n_tri long, needle-thin triangles crossing the box in random directions
+static BenchMesh make_slivers(int n_tri, std::mt19937 &rng)
+{
+   BenchMesh mesh;
+   mesh.name="slivers";
+   for(int t=0; t<n_tri; ++t){
+      Vec3f a=random_point(rng, 0.8f), b=random_point(rng, 0.8f);
+      unsigned int v=(unsigned int)mesh.x.size();
+      mesh.x.push_back(a);
+      mesh.x.push_back(b);
+      mesh.x.push_back(b+random_point(rng, 1e-3f));
+      mesh.tri.push_back(Vec3ui(v, v+1, v+2));
+   }
+   return mesh;
+}
+
+// n_tri unconnected triangles of about a twentieth of the box scattered through it
+static BenchMesh make_soup(int n_tri, std::mt19937 &rng)
+{
+   BenchMesh mesh;
+   mesh.name="soup";
+   for(int t=0; t<n_tri; ++t){
+      Vec3f c=random_point(rng, 0.75f);
+      unsigned int v=(unsigned int)mesh.x.size();
+      for(int corner=0; corner<3; ++corner) mesh.x.push_back(c+random_point(rng, 0.05f));
+      mesh.tri.push_back(Vec3ui(v, v+1, v+2));
+   }
+   return mesh;
+}
+
+// the two tetrahedra inscribed in the cube [-0.9,0.9]^3: eight triangles cutting
+// diagonally across the whole box, whose bounding boxes are the box itself
+static BenchMesh make_large_triangles()
+{
+   BenchMesh mesh;
+   mesh.name="large";
+   mesh.large=true;
+   for(int c=0; c<8; ++c)
+      mesh.x.push_back(Vec3f(c&1 ? 0.9f : -0.9f, c&2 ? 0.9f : -0.9f, c&4 ? 0.9f : -0.9f));
+   const unsigned int tetrahedra[2][4]={{0, 3, 5, 6}, {1, 2, 4, 7}};
+   for(int t=0; t<2; ++t){
+      const unsigned int *v=tetrahedra[t];
+      mesh.tri.push_back(Vec3ui(v[0], v[1], v[2]));
+      mesh.tri.push_back(Vec3ui(v[0], v[1], v[3]));
+      mesh.tri.push_back(Vec3ui(v[0], v[2], v[3]));
+      mesh.tri.push_back(Vec3ui(v[1], v[2], v[3]));
+   }
+   return mesh;
+}
+
+// a plane cutting diagonally through the box, as two triangles (like the floor of a
+// tilted architectural model)
+static BenchMesh make_diagonal_plane()
+{
+   BenchMesh mesh;
+   mesh.name="diagonal_plane";
+   mesh.large=true;
+   mesh.x.push_back(Vec3f(-0.9f, -0.9f, -0.9f));
+   mesh.x.push_back(Vec3f(0.9f, -0.9f, 0.1f));
+   mesh.x.push_back(Vec3f(0.9f, 0.9f, 0.9f));
+   mesh.x.push_back(Vec3f(-0.9f, 0.9f, -0.1f));
+   mesh.tri.push_back(Vec3ui(0, 1, 2));
+   mesh.tri.push_back(Vec3ui(0, 2, 3));
+   return mesh;
+}
+
+// the exact band as it was rasterized before it was clipped to the triangle's plane
+// slab: every cell of the triangle's bounding box grown by exact_band, for comparison
+static void rasterize_triangle_box(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, unsigned int t,
+                                   const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri,
+                                   int exact_band)
+{
+   int ni=phi.ni, nj=phi.nj, nk=phi.nk;
+   unsigned int p, q, r; assign(tri[t], p, q, r);
+   double fi[3], fj[3], fk[3];
+   grid_coordinates(tri, x, t, origin, dx, fi, fj, fk);
+   int i0=clamp(int(min(fi[0],fi[1],fi[2]))-exact_band, 0, ni-1), i1=clamp(int(max(fi[0],fi[1],fi[2]))+exact_band+1, 0, ni-1);
+   int j0=clamp(int(min(fj[0],fj[1],fj[2]))-exact_band, 0, nj-1), j1=clamp(int(max(fj[0],fj[1],fj[2]))+exact_band+1, 0, nj-1);
+   int k0=clamp(int(min(fk[0],fk[1],fk[2]))-exact_band, 0, nk-1), k1=clamp(int(max(fk[0],fk[1],fk[2]))+exact_band+1, 0, nk-1);
+   for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j) for(int i=i0; i<=i1; ++i){
+      Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+      float d=point_triangle_distance2(gx, x[p], x[q], x[r]);
+      if(d<phi(i,j,k)){
+         phi(i,j,k)=d;
+         closest_tri(i,j,k)=t;
+      }
+   }
+}
+
+static double now_seconds()
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the fastest of repeated runs of run (each after an untimed setup): at least three,
+// and more until min_time has been spent, except that runs of over a second are only
+// repeated until a second has been spent
+template<class Setup, class Run>
+static double best_seconds(double min_time, Setup setup, Run run)
+{
+   double best=1e30, spent=0;
+   for(int trial=0; trial<1 || (trial<3 && spent<1) || (spent<min_time && trial<1000); ++trial){
+      setup();
+      double start=now_seconds();
+      run();
+      double t=now_seconds()-start;
+      best=min(best, t);
+      spent+=t;
+   }
+   return best;
+}
+
+static volatile double sink; // keeps results of the distance kernels alive
+
+struct BenchReport
+{
+   std::string filter;
+   double min_time;
+   bool first;
+
+   bool wanted(const std::string &kernel) const
+   { return filter.empty() || kernel.find(filter)!=std::string::npos; }
+
+   // one result: ops operations in seconds, over cells grid cells and bytes bytes of
+   // grid (either may be 0 when it doesn't apply)
+   void add(const std::string &kernel, const std::string &input, int size, long ops, double seconds,
+            double cells, double bytes)
+   {
+      std::printf("%s\n    {\"kernel\":\"%s\",\"input\":\"%s\",\"size\":%d,\"ops\":%ld,\"seconds\":%.6g,"
+                  "\"ns_per_op\":%.4g", first ? "" : ",", kernel.c_str(), input.c_str(), size, ops, seconds,
+                  1e9*seconds/ops);
+      if(cells>0) std::printf(",\"cells_per_s\":%.4g", cells/seconds);
+      if(bytes>0) std::printf(",\"gb_per_s\":%.4g", bytes/seconds*1e-9);
+      std::printf("}");
+      std::fflush(stdout);
+      first=false;
+   }
+};
+
+// the distance and inside-triangle kernels on n_queries points against mesh's triangles
+static void bench_point_kernels(BenchReport &report, const BenchMesh &mesh, std::mt19937 &rng)
+{
+   const int n_queries=1<<16;
+   std::vector<Vec3f> q(n_queries);
+   for(int n=0; n<n_queries; ++n) q[n]=random_point(rng, 1.f);
+   auto corner=[&](int n, int c){ return mesh.x[mesh.tri[n%mesh.tri.size()][c]]; };
+   auto nothing=[](){};
+   if(report.wanted("point_triangle_distance")){
+      double s=best_seconds(report.min_time, nothing, [&](){
+         float sum=0;
+         for(int n=0; n<n_queries; ++n) sum+=point_triangle_distance2(q[n], corner(n,0), corner(n,1), corner(n,2));
+         sink=sum;
+      });
+      report.add("point_triangle_distance", mesh.name, 0, n_queries, s, 0, 0);
+   }
+   if(report.wanted("point_segment_distance")){
+      double s=best_seconds(report.min_time, nothing, [&](){
+         float sum=0;
+         for(int n=0; n<n_queries; ++n) sum+=point_segment_distance2(q[n], corner(n,0), corner(n,1));
+         sink=sum;
+      });
+      report.add("point_segment_distance", mesh.name, 0, n_queries, s, 0, 0);
+   }
+   if(report.wanted("point_in_triangle_2d")){
+      double s=best_seconds(report.min_time, nothing, [&](){
+         double sum=0, a, b, c;
+         for(int n=0; n<n_queries; ++n){
+            Vec3f p=corner(n,0), r=corner(n,1), t=corner(n,2);
+            if(point_in_triangle_2d(q[n][1], q[n][2], p[1], p[2], r[1], r[2], t[1], t[2], a, b, c)) sum+=a;
+         }
+         sink=sum;
+      });
+      report.add("point_in_triangle_2d", mesh.name, 0, n_queries, s, 0, 0);
+   }
+}
+
+// the grid stages on an n^3 grid over [-1,1]^3
+static void bench_grid_kernels(BenchReport &report, const BenchMesh &mesh, int n)
+{
+   const Vec3f origin(-1, -1, -1);
+   const float dx=2.f/n;
+   const double cells=(double)n*n*n;
+   Array3f phi;
+   LevelSetScratch scratch;
+   auto init=[&](){ init_level_set(n, n, n, 3*n*dx, phi, scratch, false); };
+   auto rasterize=[&](){
+      for(unsigned int t=0; t<mesh.tri.size(); ++t)
+         rasterize_triangle(mesh.tri, mesh.x, t, origin, dx, phi, scratch.closest_tri, 1);
+   };
+   auto intersect=[&](){
+      for(unsigned int t=0; t<mesh.tri.size(); ++t)
+         count_intersections(mesh.tri, mesh.x, t, origin, dx, n, scratch.intersection_parity);
+   };
+   long n_tri=(long)mesh.tri.size();
+   if(report.wanted("rasterize")){
+      double s=best_seconds(report.min_time, init, rasterize);
+      report.add("rasterize", mesh.name, n, n_tri, s, 0, 0);
+   }
+   // what the band clipping saves on triangles spanning the box, whose boxes hold O(n^3)
+   // cells of which only O(n^2) are in the band
+   if(mesh.large && report.wanted("rasterize_box")){
+      double s=best_seconds(report.min_time, init, [&](){
+         for(unsigned int t=0; t<mesh.tri.size(); ++t)
+            rasterize_triangle_box(mesh.tri, mesh.x, t, origin, dx, phi, scratch.closest_tri, 1);
+      });
+      report.add("rasterize_box", mesh.name, n, n_tri, s, 0, 0);
+   }
+   if(report.wanted("count_intersections")){
+      double s=best_seconds(report.min_time, init, intersect);
+      report.add("count_intersections", mesh.name, n, n_tri, s, 0, 0);
+   }
+   // one sweep in the first direction, from the rasterized grid with every brick live;
+   // its traffic is taken as phi and closest_tri streamed through once
+   if(report.wanted("sweep")){
+      init();
+      rasterize();
+      Array3f phi0=phi;
+      Array3i tri0=scratch.closest_tri;
+      int nb=(n+sweep_brick-1)/sweep_brick;
+      Array3<int> brick_changed(nb, nb, nb, 0), brick_visited(nb, nb, nb, -1);
+      double s=best_seconds(report.min_time, [&](){
+         phi=phi0;
+         scratch.closest_tri=tri0;
+         brick_visited=Array3<int>(nb, nb, nb, -1);
+      }, [&](){
+         sweep<+1,+1,+1>(mesh.tri, mesh.x, phi, scratch.closest_tri, origin, dx, brick_changed, brick_visited,
+                         1, 0);
+      });
+      report.add("sweep", mesh.name, n, (long)cells, s, cells, cells*(sizeof(float)+sizeof(int)));
+   }
+   // square roots and signs, reading squared distances and parities and writing phi
+   if(report.wanted("finish_signs")){
+      init();
+      rasterize();
+      intersect();
+      Array3f sq=phi;
+      double s=best_seconds(report.min_time, [&](){ phi=sq; }, [&](){
+         finish_level_set(phi, scratch.intersection_parity, false);
+      });
+      report.add("finish_signs", mesh.name, n, (long)cells, s, cells, cells*2*sizeof(float)+cells/8);
+   }
+   // the whole pipeline as callers see it, with its stages running on the scheduler
+   if(report.wanted("make_level_set3")){
+      double s=best_seconds(report.min_time, [](){}, [&](){
+         make_level_set3(mesh.tri, mesh.x, origin, dx, n, n, n, phi, scratch);
+      });
+      report.add("make_level_set3", mesh.name, n, (long)cells, s, cells, 0);
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   BenchReport report;
+   report.min_time=0.2;
+   report.first=true;
+   std::string label;
+   for(int a=1; a+1<argc; a+=2){
+      std::string flag(argv[a]);
+      if(flag=="--filter") report.filter=argv[a+1];
+      else if(flag=="--min-time") report.min_time=std::atof(argv[a+1]);
+      else if(flag=="--label") label=argv[a+1];
+      else{
+         std::fprintf(stderr, "usage: mesh2sdf-bench [--filter <substring>] [--min-time <seconds>] "
+                      "[--label <text>]\n");
+         return 1;
+      }
+   }
+   std::printf("{\"benchmark\":\"mesh2sdf-kernels\",\"label\":\"%s\",\"threads\":%d,\"results\":[",
+               label.c_str(), TaskScheduler::instance().size()+1);
+
+   std::mt19937 rng(12345);
+   std::vector<BenchMesh> meshes;
+   meshes.push_back(make_sphere(1000));
+   meshes.push_back(make_sphere(100000));
+   meshes.push_back(make_slivers(2000, rng));
+   meshes.push_back(make_soup(10000, rng));
+   meshes.push_back(make_large_triangles());
+   meshes.push_back(make_diagonal_plane());
+   for(size_t m=0; m<meshes.size(); ++m){
+      BenchMesh &mesh=meshes[m];
+      mesh.name+="_"+std::to_string(mesh.tri.size());
+      bench_point_kernels(report, mesh, rng);
+   }
+   const int sizes[]={64, 128, 256};
+   for(int n : sizes)
+      for(size_t m=0; m<meshes.size(); ++m)
+         bench_grid_kernels(report, meshes[m], n);
+   std::printf("\n]}\n");
+   return 0;
+}
@@ -0,0 +1,499 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "makelevelset3.h"
+#include "meshfile.h"
+#include "resultcache.h"
+#include "sdffile.h"
+
+// Batch conversion of a manifest of meshes into .sdf files, for datasets too large to
+// babysit: meshes run as concurrent jobs (each also using the shared scheduler for its
+// own parallel stages) within a memory budget, outputs are written under a temporary
+// name and renamed, and each finished mesh is appended to a journal, so a run that is
+// stopped for any reason picks up where it left off when started again. Progress is
+// logged as one JSON object per line.
+//
+// The work is a pipeline of three stages joined by bounded queues - loading, computing
+// and writing - so that while a job computes one mesh, the next is being parsed and the
+// previous one written. Each computing job has two output grids: it fills one while
+// the writers drain the other, and waits only if both are still being written.
+
+struct BatchOptions {
+   std::string manifest;     // lines of "<input>" or "<input>\t<output>"; # starts a comment
+   std::string output_dir;   // where outputs without an explicit path go, as <name>.sdf
+   std::string journal;      // defaults to <output_dir>/mesh2sdf-journal.txt
+   int jobs;                 // meshes in flight at once
+   uint64_t memory_budget;   // bytes of grids in flight at once; 0 for no limit
+   int size;                 // cells along the longest side of the mesh's box...
+   float dx;                 // ...unless the cell size is given
+   int padding;              // cells around the mesh's box
+   float truncation;         // see make_level_set3; 0 for none
+   int chunk_size;           // see write_sdf; 0 for dense files
+   float tolerance;
+   int loaders, writers;     // threads parsing meshes ahead of the jobs and writing behind them
+   FILE* log;
+
+   BatchOptions() : jobs(1), memory_budget(0), size(128), dx(0), padding(2), truncation(0),
+                    chunk_size(0), tolerance(0), loaders(1), writers(1), log(stdout) {}
+};
+
+namespace batch_detail {
+   // s as a JSON string
+   inline std::string json(const std::string& s) {
+      std::string out = "\"";
+      for (size_t n = 0; n < s.size(); ++n) {
+         unsigned char c = s[n];
+         if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+         } else if (c < 0x20) {
+            char e[8];
+            std::snprintf(e, sizeof(e), "\\u%04x", c);
+            out += e;
+         } else {
+            out += (char)c;
+         }
+      }
+      return out + "\"";
+   }
+
+   struct Item {
+      std::string input, output;
+   };
+
+   // the message of the exception being handled (call from a catch block)
+   inline std::string exception_message() {
+      try {
+         throw;
+      } catch (const std::exception& e) {
+         return e.what();
+      } catch (...) {
+         return "unknown error";
+      }
+   }
+
+   inline double seconds_since(std::chrono::steady_clock::time_point start) {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+
+   // bytes of grid held by a job on an ni x nj x nk grid: phi, the closest triangles
+   // and the intersection parities
+   inline uint64_t grid_footprint(int ni, int nj, int nk) {
+      uint64_t cells = (uint64_t)ni * nj * nk;
+      return cells * (sizeof(float) + sizeof(int)) + (uint64_t)((ni + 63) / 64) * nj * nk * 8;
+   }
+
+   // A budget of bytes that jobs take from and give back. A job larger than the whole
+   // budget still runs, but only once nothing else holds any of it.
+   class MemoryBudget {
+   public:
+      explicit MemoryBudget(uint64_t total_) : total(total_), used(0) {}
+
+      void acquire(uint64_t bytes) {
+         if (total == 0) return;
+         std::unique_lock<std::mutex> lock(mutex);
+         cv.wait(lock, [&]() { return used == 0 || used + bytes <= total; });
+         used += bytes;
+      }
+
+      void release(uint64_t bytes) {
+         if (total == 0) return;
+         std::lock_guard<std::mutex> lock(mutex);
+         used -= bytes;
+         cv.notify_all();
+      }
+
+   private:
+      uint64_t total, used;
+      std::mutex mutex;
+      std::condition_variable cv;
+   };
+
+   // A first-in first-out queue between two stages of the pipeline, holding at most
+   // capacity items: push waits for room, and pop waits for an item and returns false
+   // once the queue is closed and empty.
+   template<class T>
+   class BoundedQueue {
+   public:
+      explicit BoundedQueue(size_t capacity_) : capacity(max(capacity_, (size_t)1)), closed(false) {}
+
+      void push(T item) {
+         std::unique_lock<std::mutex> lock(mutex);
+         not_full.wait(lock, [&]() { return items.size() < capacity; });
+         items.push_back(std::move(item));
+         not_empty.notify_one();
+      }
+
+      bool pop(T& item) {
+         std::unique_lock<std::mutex> lock(mutex);
+         not_empty.wait(lock, [&]() { return !items.empty() || closed; });
+         if (items.empty()) return false;
+         item = std::move(items.front());
+         items.pop_front();
+         not_full.notify_one();
+         return true;
+      }
+
+      void close() {
+         std::lock_guard<std::mutex> lock(mutex);
+         closed = true;
+         not_empty.notify_all();
+      }
+
+   private:
+      size_t capacity;
+      bool closed;
+      std::deque<T> items;
+      std::mutex mutex;
+      std::condition_variable not_empty, not_full;
+   };
+
+   // a mesh loaded and fitted with a grid, on its way to a job
+   struct LoadedMesh {
+      size_t item;
+      std::vector<Vec3f> x;
+      std::vector<Vec3ui> tri;
+      Vec3f origin;
+      float dx;
+      int n[3];
+      double load_s;
+   };
+
+   // a computed grid on its way to a writer, which gives the grid back to its job
+   struct ComputedGrid {
+      size_t item;
+      Array3f* phi;
+      BoundedQueue<Array3f*>* owner;
+      SdfHeader header;
+      size_t vertices, triangles;
+      uint64_t phi_bytes;       // of the budget, still held for phi
+      double load_s, wait_s, compute_s;
+   };
+
+   // flush the directory holding path to storage, so that a rename into it is durable
+   inline bool fsync_parent(const std::string& path) {
+      size_t slash = path.rfind('/');
+      std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+      int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+      if (fd < 0) return false;
+      bool ok = fsync(fd) == 0;
+      return close(fd) == 0 && ok;
+   }
+
+   // the journal of finished outputs: read once at the start, then appended to (and
+   // flushed to disk) as each one is written
+   class Journal {
+   public:
+      Journal() : file(0) {}
+
+      bool open(const std::string& path) {
+         std::ifstream in(path.c_str());
+         std::string line;
+         while (std::getline(in, line))
+            if (!line.empty()) done.insert(line);
+         file = std::fopen(path.c_str(), "a");
+         return file != 0;
+      }
+      ~Journal() {
+         if (file) std::fclose(file);
+      }
+
+      bool contains(const std::string& input) const { return done.count(input) != 0; }
+
+      void add(const std::string& input) {
+         std::lock_guard<std::mutex> lock(mutex);
+         std::fprintf(file, "%s\n", input.c_str());
+         std::fflush(file);
+         fsync(fileno(file));
+      }
+
+   private:
+      std::set<std::string> done;
+      FILE* file;
+      std::mutex mutex;
+   };
+
+   inline bool read_manifest(const BatchOptions& options, std::vector<Item>& items, std::string& error) {
+      std::ifstream in(options.manifest.c_str());
+      if (!in) {
+         error = "cannot open " + options.manifest;
+         return false;
+      }
+      std::string line;
+      while (std::getline(in, line)) {
+         if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+         if (line.empty() || line[0] == '#') continue;
+         Item item;
+         size_t tab = line.find('\t');
+         item.input = line.substr(0, tab);
+         if (tab != std::string::npos) {
+            item.output = line.substr(tab + 1);
+         } else {
+            size_t slash = item.input.rfind('/');
+            std::string name = slash == std::string::npos ? item.input : item.input.substr(slash + 1);
+            size_t dot = name.rfind('.');
+            if (dot != std::string::npos && dot > 0) name = name.substr(0, dot);
+            item.output = options.output_dir + "/" + name + ".sdf";
+         }
+         items.push_back(item);
+      }
+      return true;
+   }
+
+   // the grid over the mesh's bounding box grown by padding cells on each side, with
+   // cubic cells of side dx or sized so that size samples (padding included) span its
+   // longest side; false if there is no such grid
+   inline bool fit_grid(const std::vector<Vec3f>& x, const BatchOptions& options, Vec3f& origin, float& dx,
+                        int n[3]) {
+      if (x.empty()) return false;
+      Vec3f lo = x[0], hi = x[0];
+      for (size_t v = 1; v < x.size(); ++v) update_minmax(x[v], lo, hi);
+      Vec3f extent = hi - lo;
+      dx = options.dx > 0 ? options.dx : padded_grid_spacing(max(extent), options.size, options.padding);
+      if (!(dx > 0) || !std::isfinite(dx)) return false;
+      origin = lo - Vec3f((float)options.padding * dx);
+      for (int a = 0; a < 3; ++a)
+         n[a] = padded_grid_samples(extent[a], dx, options.padding);
+      return true;
+   }
+}
+
+// Run the batch; returns the number of inputs that failed (so 0 on success), or -1 if
+// the run could not start at all
+inline int run_batch(const BatchOptions& options) {
+   using namespace batch_detail;
+   std::chrono::steady_clock::time_point run_start = std::chrono::steady_clock::now();
+   FILE* log = options.log;
+   std::mutex log_mutex;
+   auto emit = [&](const std::string& line) {
+      std::lock_guard<std::mutex> lock(log_mutex);
+      std::fprintf(log, "%s\n", line.c_str());
+      std::fflush(log);
+   };
+
+   std::vector<Item> items;
+   std::string error;
+   if (mkdir(options.output_dir.c_str(), 0777) != 0 && errno != EEXIST) error = "cannot create " + options.output_dir;
+   if (error.empty()) read_manifest(options, items, error);
+   Journal journal;
+   std::string journal_path = options.journal.empty() ? options.output_dir + "/mesh2sdf-journal.txt"
+                                                      : options.journal;
+   if (error.empty() && !journal.open(journal_path)) error = "cannot open " + journal_path;
+   if (!error.empty()) {
+      emit("{\"event\":\"error\",\"message\":" + json(error) + "}");
+      return -1;
+   }
+
+   std::vector<size_t> todo;
+   for (size_t n = 0; n < items.size(); ++n)
+      if (!journal.contains(items[n].output)) todo.push_back(n);
+   int jobs = max(options.jobs, 1), loaders = max(options.loaders, 1), writers = max(options.writers, 1);
+   char line[1024];
+   std::snprintf(line, sizeof(line),
+                 "{\"event\":\"start\",\"meshes\":%zu,\"already_done\":%zu,\"jobs\":%d,\"loaders\":%d,"
+                 "\"writers\":%d,\"memory_budget\":%llu}",
+                 items.size(), items.size() - todo.size(), jobs, loaders, writers,
+                 (unsigned long long)options.memory_budget);
+   emit(line);
+
+   MemoryBudget budget(options.memory_budget);
+   BoundedQueue<LoadedMesh> loaded(jobs);
+   BoundedQueue<ComputedGrid> computed(2 * jobs);
+   std::atomic<size_t> next(0);
+   std::atomic<int> done(0), failed(0), loaders_left(loaders), jobs_left(jobs);
+   // seconds each stage spent working, summed over its threads
+   std::mutex busy_mutex;
+   double load_busy = 0, compute_busy = 0, write_busy = 0;
+   auto add_busy = [&](double& total, double s) {
+      std::lock_guard<std::mutex> lock(busy_mutex);
+      total += s;
+   };
+   auto fail = [&](size_t item, const std::string& message) {
+      ++failed;
+      emit("{\"event\":\"error\",\"input\":" + json(items[item].input) + ",\"message\":" + json(message) + "}");
+   };
+
+   auto load = [&]() {
+      for (size_t k; (k = next++) < todo.size();) {
+         const Item& item = items[todo[k]];
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+         LoadedMesh mesh;
+         mesh.item = todo[k];
+         std::string message;
+         bool ok = false;
+         try {
+            ok = load_mesh(item.input, mesh.x, mesh.tri, &message);
+            if (ok && !fit_grid(mesh.x, options, mesh.origin, mesh.dx, mesh.n)) {
+               ok = false;
+               message = item.input + ": no grid fits the mesh with these options";
+            }
+         } catch (...) {
+            ok = false;
+            message = item.input + ": " + exception_message();
+         }
+         mesh.load_s = seconds_since(start);
+         add_busy(load_busy, mesh.load_s);
+         if (ok)
+            loaded.push(std::move(mesh));
+         else
+            fail(mesh.item, message);
+      }
+      if (--loaders_left == 0) loaded.close();
+   };
+
+   auto compute = [&]() {
+      LevelSetScratch scratch;
+      Array3f grids[2];
+      BoundedQueue<Array3f*> free_grids(2);
+      free_grids.push(&grids[0]);
+      free_grids.push(&grids[1]);
+      for (LoadedMesh mesh; loaded.pop(mesh);) {
+         const int* n = mesh.n;
+         uint64_t footprint = grid_footprint(n[0], n[1], n[2]);
+         uint64_t phi_bytes = (uint64_t)n[0] * n[1] * n[2] * sizeof(float);
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+         // free_grids is never closed, so this waits until a grid is free
+         Array3f* phi = nullptr;
+         bool popped = free_grids.pop(phi);
+         assert(popped);
+         (void)popped;
+         budget.acquire(footprint);
+         double wait_s = seconds_since(start);
+
+         start = std::chrono::steady_clock::now();
+         std::string message;
+         try {
+            make_level_set3(mesh.tri, mesh.x, mesh.origin, mesh.dx, n[0], n[1], n[2], *phi, scratch, 1, 2,
+                            false, options.truncation);
+         } catch (...) {
+            message = exception_message();
+         }
+         // the scratch grids go back now; phi's share goes back once it is written
+         scratch.closest_tri.clear();
+         scratch.intersection_parity.clear();
+         if (!message.empty()) {
+            // this mesh failed, but the job carries on with the next
+            phi->clear();
+            budget.release(footprint);
+            free_grids.push(phi);
+            fail(mesh.item, items[mesh.item].input + ": " + message);
+            continue;
+         }
+         budget.release(footprint - phi_bytes);
+
+         ComputedGrid grid;
+         grid.item = mesh.item;
+         grid.phi = phi;
+         grid.owner = &free_grids;
+         for (int a = 0; a < 3; ++a) grid.header.origin[a] = mesh.origin[a];
+         grid.header.dx = mesh.dx;
+         grid.header.sign_method = sdf_parity;
+         CacheKey key = mesh_key(mesh.x, mesh.tri);
+         grid.header.mesh_hash[0] = key.h0;
+         grid.header.mesh_hash[1] = key.h1;
+         if (options.chunk_size > 0) {
+            grid.header.chunk_size = options.chunk_size;
+            grid.header.codec = sdf_codec_delta;
+            grid.header.tolerance = options.tolerance;
+         }
+         grid.vertices = mesh.x.size();
+         grid.triangles = mesh.tri.size();
+         grid.phi_bytes = phi_bytes;
+         grid.load_s = mesh.load_s;
+         grid.wait_s = wait_s;
+         grid.compute_s = seconds_since(start);
+         add_busy(compute_busy, grid.compute_s);
+         computed.push(std::move(grid));
+      }
+      // the grids live here, so wait for the writers to hand both back
+      Array3f* phi = nullptr;
+      for (int returned = 0; returned < 2; ++returned) {
+         bool popped = free_grids.pop(phi);
+         assert(popped);
+         (void)popped;
+      }
+      if (--jobs_left == 0) computed.close();
+   };
+
+   auto write = [&]() {
+      for (ComputedGrid grid; computed.pop(grid);) {
+         const Item& item = items[grid.item];
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+         SdfWriteStats write_stats;
+         std::string tmp_path = item.output + "." + generate_uuid() + ".tmp";
+         std::string message = "cannot write " + item.output;
+         bool ok = false;
+         try {
+            // the data reaches storage before the rename, and the rename before the
+            // journal says the output is done, so a crash can't leave a journaled
+            // output that is missing or incomplete
+            ok = write_sdf(tmp_path, *grid.phi, grid.header, 4 * (float)grid.header.dx, &write_stats,
+                           true) &&
+                 rename(tmp_path.c_str(), item.output.c_str()) == 0 && fsync_parent(item.output);
+         } catch (...) {
+            message += ": " + exception_message();
+         }
+         if (!ok) unlink(tmp_path.c_str());
+         int n[3] = {grid.phi->ni, grid.phi->nj, grid.phi->nk};
+         grid.phi->clear();
+         budget.release(grid.phi_bytes);
+         grid.owner->push(grid.phi);
+         double write_s = seconds_since(start);
+         add_busy(write_busy, write_s);
+         if (!ok) {
+            fail(grid.item, message);
+            continue;
+         }
+         journal.add(item.output);
+         int finished = ++done;
+         double elapsed = seconds_since(run_start);
+         char fields[512];
+         std::snprintf(fields, sizeof(fields),
+                       ",\"vertices\":%zu,\"triangles\":%zu,\"grid\":[%d,%d,%d],\"bytes\":%llu,"
+                       "\"load_s\":%.4f,\"wait_s\":%.4f,\"compute_s\":%.4f,\"write_s\":%.4f,"
+                       "\"done\":%d,\"meshes_per_minute\":%.2f}",
+                       grid.vertices, grid.triangles, n[0], n[1], n[2],
+                       (unsigned long long)write_stats.file_bytes, grid.load_s, grid.wait_s, grid.compute_s,
+                       write_s, finished, elapsed > 0 ? 60 * finished / elapsed : 0);
+         emit("{\"event\":\"mesh\",\"input\":" + json(item.input) + ",\"output\":" + json(item.output) + fields);
+      }
+   };
+
+   std::vector<std::thread> threads;
+   for (int t = 0; t < loaders; ++t) threads.emplace_back(load);
+   for (int t = 0; t < writers; ++t) threads.emplace_back(write);
+   for (int t = 1; t < jobs; ++t) threads.emplace_back(compute);
+   compute();
+   for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+
+   double elapsed = seconds_since(run_start);
+   std::snprintf(line, sizeof(line),
+                 "{\"event\":\"summary\",\"done\":%d,\"failed\":%d,\"skipped\":%zu,\"seconds\":%.3f,"
+                 "\"load_busy_s\":%.3f,\"compute_busy_s\":%.3f,\"write_busy_s\":%.3f,\"meshes_per_minute\":%.2f}",
+                 done.load(), failed.load(), items.size() - todo.size(), elapsed, load_busy, compute_busy,
+                 write_busy, elapsed > 0 ? 60 * done.load() / elapsed : 0);
+   emit(line);
+   return failed;
+}
+
+#endif // BATCH_H
@@ -4,25 +4,74 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <string>
 #include <stdexcept>
 #include <iostream>
 #include <climits>
+#include <mutex>
 #include <sstream>
 #include <random>
 
-// Generate UUID string
+// Generate UUID string; safe to call from several threads at once
 inline std::string generate_uuid() {
+   static std::mutex mutex;
    static std::random_device rd;
    static std::mt19937 gen(rd());
    static std::uniform_int_distribution<uint64_t> dis;
+   std::lock_guard<std::mutex> lock(mutex);
    std::stringstream ss;
    ss << std::hex << dis(gen);
    return ss.str();
 }
 
+// Totals over every DiskArray1 in the process, for seeing how much goes through the
+// backing files
+struct DiskArrayStats {
+   uint64_t files;        // backing files created
+   uint64_t bytes;        // bytes of backing file allocated
+   uint64_t live_bytes;   // bytes mapped right now
+   uint64_t peak_bytes;   // most bytes mapped at once
+};
+
+namespace disk_array_detail {
+   struct Counters {
+      std::atomic<uint64_t> files, bytes, live_bytes, peak_bytes;
+      Counters() : files(0), bytes(0), live_bytes(0), peak_bytes(0) {}
+   };
+
+   inline Counters& counters() {
+      static Counters c;
+      return c;
+   }
+
+   inline void mapped(uint64_t bytes) {
+      Counters& c = counters();
+      ++c.files;
+      c.bytes += bytes;
+      uint64_t live = c.live_bytes += bytes;
+      uint64_t peak = c.peak_bytes;
+      while (live > peak && !c.peak_bytes.compare_exchange_weak(peak, live)) {}
+   }
+
+   inline void unmapped(uint64_t bytes) { counters().live_bytes -= bytes; }
+}
+
+// Read the totals; reset starts files, bytes and the peak over from now
+inline DiskArrayStats disk_array_stats(bool reset = false) {
+   disk_array_detail::Counters& c = disk_array_detail::counters();
+   DiskArrayStats s = {c.files, c.bytes, c.live_bytes, c.peak_bytes};
+   if (reset) {
+      c.files = 0;
+      c.bytes = 0;
+      c.peak_bytes = c.live_bytes.load();
+   }
+   return s;
+}
+
 // Disk-backed 1D array for POD types, modeled after Array1<T>
 template<typename T>
 struct DiskArray1 {
@@ -72,7 +121,7 @@ struct DiskArray1 {
    }
 
    ~DiskArray1() {
-      if (data) munmap(data, max_n * sizeof(T));
+      if (data) unmap(data, max_n * sizeof(T));
       if (fd >= 0) close(fd);
 #ifndef NDEBUG
       data = 0; n = max_n = 0;
@@ -174,16 +223,14 @@ struct DiskArray1 {
       }
       T* old_data = data;
       size_t old_size = max_n * sizeof(T);
-      std::string old_filename = filename;
       int old_fd = fd;
+      map_file(new_n);
       n = new_n;
       max_n = new_n;
-      map_file(new_n);
       if (old_data) {
          std::memcpy(data, old_data, old_size);
-         munmap(old_data, old_size);
+         unmap(old_data, old_size);
          close(old_fd);
-         unlink(old_filename.c_str());
       }
    }
 
@@ -218,14 +265,12 @@ struct DiskArray1 {
       if (n == max_n) return;
       T* old_data = data;
       size_t old_size = max_n * sizeof(T);
-      std::string old_filename = filename;
       int old_fd = fd;
-      max_n = n;
       map_file(n);
+      max_n = n;
       std::memcpy(data, old_data, n * sizeof(T));
-      munmap(old_data, old_size);
+      unmap(old_data, old_size);
       close(old_fd);
-      unlink(old_filename.c_str());
    }
 
    size_type size() const { return n; }
@@ -248,7 +293,7 @@ struct DiskArray1 {
 
    bool empty() const { return n == 0; }
    void clear() {
-      if (data) munmap(data, max_n * sizeof(T));
+      if (data) unmap(data, max_n * sizeof(T));
       if (fd >= 0) close(fd);
       data = nullptr;
       fd = -1;
@@ -258,18 +303,35 @@ struct DiskArray1 {
    }
 
 private:
+   // map a new backing file of elems elements to data (and fd). The file is unlinked as
+   // soon as it is open, so it lives only as long as the mapping and nothing is left in
+   // /data/tmp however the array (or the process) ends. On failure nothing changes.
    void map_file(unsigned long elems) {
-      if (filename.empty()) {
-         std::stringstream ss;
-         ss << "/data/tmp/file_" << getpid() << "_" << generate_uuid();
-         filename = ss.str();
-      }
+      std::stringstream ss;
+      ss << "/data/tmp/file_" << getpid() << "_" << generate_uuid();
+      std::string name = ss.str();
       size_t bytes = elems * sizeof(T);
-      fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
-      if (fd < 0) throw std::runtime_error("open failed");
-      if (ftruncate(fd, bytes) != 0) throw std::runtime_error("ftruncate failed");
-      data = (T*)mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-      if (data == MAP_FAILED) throw std::runtime_error("mmap failed");
+      int new_fd = open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+      if (new_fd < 0) throw std::runtime_error("open failed");
+      unlink(name.c_str());
+      if (ftruncate(new_fd, bytes) != 0) {
+         close(new_fd);
+         throw std::runtime_error("ftruncate failed");
+      }
+      void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, new_fd, 0);
+      if (p == MAP_FAILED) {
+         close(new_fd);
+         throw std::runtime_error("mmap failed");
+      }
+      data = (T*)p;
+      fd = new_fd;
+      filename = name;
+      disk_array_detail::mapped(bytes);
+   }
+
+   static void unmap(T* p, size_t bytes) {
+      munmap(p, bytes);
+      disk_array_detail::unmapped(bytes);
    }
 };
 
@@ -0,0 +1,188 @@
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "batch.h"
+#include "makelevelset3.h"
+#include "meshfile.h"
+#include "resultcache.h"
+#include "sdffile.h"
+
+// mesh2sdf-cli batch <manifest> <output_dir> [options]
+static int batch_main(int argc, char* argv[]) {
+  BatchOptions options;
+  options.manifest = argv[2];
+  options.output_dir = argv[3];
+  for (int a = 4; a < argc; ++a) {
+    std::string flag(argv[a]);
+    if (a + 1 == argc) {
+      std::cerr << "Error: " << flag << " needs a value.\n";
+      return -1;
+    }
+    const char* value = argv[++a];
+    if (flag == "--jobs") {
+      options.jobs = atoi(value);
+    } else if (flag == "--loaders") {
+      options.loaders = atoi(value);
+    } else if (flag == "--writers") {
+      options.writers = atoi(value);
+    } else if (flag == "--memory-mb") {
+      options.memory_budget = (uint64_t)(atof(value) * (1 << 20));
+    } else if (flag == "--size") {
+      options.size = atoi(value);
+    } else if (flag == "--dx") {
+      options.dx = (float)atof(value);
+    } else if (flag == "--padding") {
+      options.padding = atoi(value);
+    } else if (flag == "--truncation") {
+      options.truncation = (float)atof(value);
+    } else if (flag == "--chunk") {
+      options.chunk_size = atoi(value);
+    } else if (flag == "--tolerance") {
+      options.tolerance = (float)atof(value);
+    } else if (flag == "--journal") {
+      options.journal = value;
+    } else {
+      std::cerr << "Error: Unknown option " << flag << ".\n";
+      return -1;
+    }
+  }
+  if (options.jobs < 1 || options.loaders < 1 || options.writers < 1 ||
+      options.padding < 0 ||
+      (options.dx <= 0 && options.size <= 2 * options.padding + 1)) {
+    std::cerr << "Error: Expected --jobs, --loaders and --writers of at least 1 "
+                 "and a grid larger than its padding.\n";
+    return -1;
+  }
+  int failed = run_batch(options);
+  return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc >= 4 && std::string(argv[1]) == "batch") return batch_main(argc, argv);
+  if (argc < 3 || argc > 5) {
+    std::cout << "mesh2sdf-cli - A utility for converting closed oriented "
+                 "triangle meshes into grid-based signed distance fields.\n";
+    std::cout << "\nThe output is a .sdf file: a 128-byte header (see "
+                 "sdffile.h) with the grid dimensions, origin and cell size, "
+                 "followed by the signed distances as 32-bit floats in "
+                 "ascending order of i, then j, then k, starting at byte "
+                 "offset 128 - or, if <chunk> is given, as compressed cubes of "
+                 "<chunk>^3 samples listed in a chunk table.\n";
+
+    std::cout << "The output filename will match that of the input, with the "
+                 "suffix replaced with SDF.\n\n";
+
+    std::cout << "Usage: mesh2sdf-cli <filename> <dx> [<chunk> [<tolerance>]]\n\n";
+    std::cout << "Where:\n";
+    std::cout << "\t<filename> specifies a Wavefront OBJ (text), binary PLY "
+                 "or binary STL file, by its suffix \".obj\", \".ply\" or "
+                 "\".stl\"; polygons are split into triangles, and STL "
+                 "corners at the same position are merged.\n";
+    std::cout << "\t<dx> specifies the length of grid cell in the resulting "
+                 "distance field.\n";
+    std::cout << "\t<chunk> (e.g. 32) stores the field in compressed chunks of "
+                 "that size; chunks that are constant are left out.\n";
+    std::cout << "\t<tolerance> allows chunks further than 4 cells from the "
+                 "surface to be stored with up to that error.\n";
+
+    std::cout << "\nBatch usage: mesh2sdf-cli batch <manifest> <output_dir> "
+                 "[--jobs N] [--loaders L] [--writers W] [--memory-mb M] "
+                 "[--size n | --dx d] "
+                 "[--padding p] [--truncation t] [--chunk c] [--tolerance tol] "
+                 "[--journal path]\n\n";
+    std::cout << "\t<manifest> lists one mesh per line, optionally followed "
+                 "by a tab and its output path (otherwise "
+                 "<output_dir>/<name>.sdf); lines starting with # are "
+                 "skipped.\n";
+    std::cout << "\tEach mesh gets a grid over its bounding box grown by "
+                 "<p> cells (default 2), with cells of side <d> or <n> cells "
+                 "(default 128) along its longest side.\n";
+    std::cout << "\t<N> meshes (default 1) are converted at once, holding at "
+                 "most <M> MB of grids between them (default no limit).\n";
+    std::cout << "\t<L> threads (default 1) load meshes ahead of the jobs "
+                 "and <W> threads (default 1) write their results behind "
+                 "them, so parsing and writing overlap the computation.\n";
+    std::cout << "\tFinished outputs are recorded in the journal (default "
+                 "<output_dir>/mesh2sdf-journal.txt) and skipped when the "
+                 "batch is run again. Progress is printed as JSON lines.\n";
+
+    exit(-1);
+  }
+
+  // Parse cmd paramters
+  std::string filename(argv[1]);
+  size_t dot = filename.rfind('.');
+  if (dot == std::string::npos || dot == 0) {
+    std::cerr << "Error: Expected a mesh file named <name>.obj, <name>.ply "
+                 "or <name>.stl.\n";
+    exit(-1);
+  }
+
+  std::stringstream arg2(argv[2]);
+  float dx;
+  arg2 >> dx;
+  int chunk_size = argc > 3 ? atoi(argv[3]) : 0;
+  float tolerance = argc > 4 ? (float)atof(argv[4]) : 0.0f;
+
+  // Load the obj file
+  std::cout << "Reading data.\n";
+  std::vector<Vec3f> vertList;
+  std::vector<Vec3ui> faceList;
+  std::string error;
+  MeshLoadStats load_stats;
+  if (!load_mesh(filename, vertList, faceList, &error, &load_stats)) {
+    std::cerr << error << "\n";
+    exit(-1);
+  }
+  std::cout << "Read in " << vertList.size() << " vertices and "
+            << faceList.size() << " triangles (" << load_stats.polygons
+            << " faces, " << load_stats.welded << " corners welded) from "
+            << load_stats.bytes * 1e-6 << " MB in "
+            << load_stats.seconds << " s (" << load_stats.mb_per_second()
+            << " MB/s)." << std::endl;
+
+  // Set bounding box
+  Vec3f min_box(-1.0f, -1.0f, -1.0f);
+  Vec3f max_box(1.0f, 1.0f, 1.0f);
+
+  // Add padding around the box.
+  Vec3f unit(1, 1, 1);
+  Vec3ui sizes = Vec3ui((max_box - min_box) / dx);
+  std::cout << "Bound box size: (" << min_box << ") to (" << max_box
+            << ") with dimensions " << sizes << "." << std::endl;
+
+  // Make level sets
+  std::cout << "Computing signed distance field.\n";
+  Array3f phi_grid;
+  make_level_set3(faceList, vertList, min_box, dx, sizes[0], sizes[1], sizes[2],
+                  phi_grid);
+
+  // Save to binary files
+  std::string outname;
+  outname = filename.substr(0, dot) + std::string(".sdf");
+  std::cout << "Writing results to: " << outname << "\n";
+  CacheKey mesh = mesh_key(vertList, faceList);
+  SdfHeader header;
+  for (int a = 0; a < 3; ++a) header.origin[a] = min_box[a];
+  header.dx = dx;
+  header.sign_method = sdf_parity;
+  if (chunk_size > 0) {
+    header.chunk_size = chunk_size;
+    header.codec = sdf_codec_delta;
+    header.tolerance = tolerance;
+  }
+  SdfWriteStats stats;
+  header.mesh_hash[0] = mesh.h0;
+  header.mesh_hash[1] = mesh.h1;
+  if (!write_sdf(outname, phi_grid, header, 4 * dx, &stats)) {
+    std::cerr << "Failed to write " << outname << ".\n";
+    exit(-1);
+  }
+  std::cout << "Wrote " << stats.file_bytes << " bytes (" << stats.ratio()
+            << "x smaller than raw floats, " << stats.elided_chunks << " of "
+            << stats.chunks << " chunks elided, " << stats.quantized_chunks
+            << " quantized) at " << stats.gb_per_second() << " GB/s.\n";
+  std::cout << "Processing complete.\n";
+  return 0;
+}
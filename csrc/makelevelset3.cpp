@@ -1,7 +1,15 @@
 #include "makelevelset3.h"
+#include "parallel.h"
 
-// find distance x0 is from segment x1-x2
-static float point_segment_distance(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2)
+#include <climits>
+#include <cstring>
+#include <limits>
+
+// Internally phi holds squared distances while rasterizing and sweeping, since those
+// stages only compare distances; the square root is taken once per cell at the end.
+
+// find squared distance x0 is from segment x1-x2
+static float point_segment_distance2(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2)
 {
    Vec3f dx(x2-x1);
    double m2=mag2(dx);
@@ -13,11 +21,11 @@ static float point_segment_distance(const Vec3f &x0, const Vec3f &x1, const Vec3
       s12=1;
    }
    // and find the distance
-   return dist(x0, s12*x1+(1-s12)*x2);
+   return dist2(x0, s12*x1+(1-s12)*x2);
 }
 
-// find distance x0 is from triangle x1-x2-x3
-static float point_triangle_distance(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2, const Vec3f &x3)
+// find squared distance x0 is from triangle x1-x2-x3
+static float point_triangle_distance2(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2, const Vec3f &x3)
 {
    // first find barycentric coordinates of closest point on infinite plane
    Vec3f x13(x1-x3), x23(x2-x3), x03(x0-x3);
@@ -29,56 +37,185 @@ static float point_triangle_distance(const Vec3f &x0, const Vec3f &x1, const Vec
    float w31=invdet*(m13*b-d*a);
    float w12=1-w23-w31;
    if(w23>=0 && w31>=0 && w12>=0){ // if we're inside the triangle
-      return dist(x0, w23*x1+w31*x2+w12*x3); 
+      return dist2(x0, w23*x1+w31*x2+w12*x3);
    }else{ // we have to clamp to one of the edges
       if(w23>0) // this rules out edge 2-3 for us
-         return min(point_segment_distance(x0,x1,x2), point_segment_distance(x0,x1,x3));
+         return min(point_segment_distance2(x0,x1,x2), point_segment_distance2(x0,x1,x3));
       else if(w31>0) // this rules out edge 1-3
-         return min(point_segment_distance(x0,x1,x2), point_segment_distance(x0,x2,x3));
+         return min(point_segment_distance2(x0,x1,x2), point_segment_distance2(x0,x2,x3));
       else // w12 must be >0, ruling out edge 1-2
-         return min(point_segment_distance(x0,x1,x3), point_segment_distance(x0,x2,x3));
+         return min(point_segment_distance2(x0,x1,x3), point_segment_distance2(x0,x2,x3));
    }
 }
 
-static void check_neighbour(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
-                            Array3f &phi, Array3i &closest_tri,
-                            const Vec3f &gx, int i0, int j0, int k0, int i1, int j1, int k1)
+// returns true if phi[n0] (a squared distance) was improved using the closest triangle
+// of cell n1, where both are linear indices into the grids' storage. If moved_tri is
+// given, only moved triangles are passed on, or any triangle to cells that have a moved one.
+static inline bool check_neighbour(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                                   float *phi, int *closest_tri, const Vec3f &gx, long n0, long n1,
+                                   const char *moved_tri)
 {
-   if(closest_tri(i1,j1,k1)>=0){
-      unsigned int p, q, r; assign(tri[closest_tri(i1,j1,k1)], p, q, r);
-      float d=point_triangle_distance(gx, x[p], x[q], x[r]);
-      if(d<phi(i0,j0,k0)){
-         phi(i0,j0,k0)=d;
-         closest_tri(i0,j0,k0)=closest_tri(i1,j1,k1);
+   if(closest_tri[n1]>=0){
+      if(moved_tri && !moved_tri[closest_tri[n1]] && (closest_tri[n0]<0 || !moved_tri[closest_tri[n0]]))
+         return false;
+      unsigned int p, q, r; assign(tri[closest_tri[n1]], p, q, r);
+      float d=point_triangle_distance2(gx, x[p], x[q], x[r]);
+      if(d<phi[n0]){
+         phi[n0]=d;
+         closest_tri[n0]=closest_tri[n1];
+         return true;
       }
    }
+   return false;
+}
+
+// the sweep visits the grid in cubic bricks of this many cells a side, so that the
+// planes of phi and closest_tri it reads stay in cache instead of streaming the whole grid
+static const int sweep_brick=16;
+
+// find the cells [i0,i1) (in sweep order, so i0>i1 when d<0) of brick b along an axis
+// of n cells; the first layer in the sweep direction has no upstream neighbour. An axis
+// of a single cell is swept within its plane instead (see sweep_stride).
+static void brick_range(int b, int d, int n, int &i0, int &i1)
+{
+   if(n==1){ i0=0; i1=d; return; }
+   int lo=max(b*sweep_brick, d>0 ? 1 : 0), hi=min((b+1)*sweep_brick, d>0 ? n : n-1);
+   if(d>0){ i0=lo; i1=hi; }
+   else{ i0=hi-1; i1=lo-1; }
+}
+
+// the offset to the upstream neighbour along an axis of n cells in direction d, for a
+// stride of s; a grid one cell thick has no neighbours across that axis, so its cells are
+// swept from their neighbours in the plane, checking against themselves across it
+static inline long sweep_stride(int d, int n, long s)
+{
+   return n>1 ? d*s : 0;
+}
+
+// what sweeping needs to update a finished grid after some triangles moved
+struct SweepUpdate
+{
+   Array3<int> brick_changed;     // 0 for the bricks the update modified, -1 elsewhere
+   Array3<char> squared_bricks;   // the bricks brought back to squared distances so far
+   Array3<char> lost_bricks;      // the bricks with cells whose closest triangle moved
+   std::vector<char> moved_tri;   // which triangles moved
+};
+
+// bring brick (bi,bj,bk) of a finished grid back to squared distances so it can be swept,
+// and mark it in squared_bricks. Squaring the square roots would be off by rounding,
+// which sweeping would then take for improvements, so the distances are found again
+// from the closest triangles - exactly as they were computed before.
+static void square_brick(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                         Array3f &phi, const Array3i &closest_tri, const Vec3f &origin, float dx,
+                         int bi, int bj, int bk, Array3<char> &squared_bricks)
+{
+   for(int k=bk*sweep_brick; k<min((bk+1)*sweep_brick, phi.nk); ++k)
+      for(int j=bj*sweep_brick; j<min((bj+1)*sweep_brick, phi.nj); ++j)
+         for(int i=bi*sweep_brick; i<min((bi+1)*sweep_brick, phi.ni); ++i){
+            int t=closest_tri(i,j,k);
+            if(t<0){
+               phi(i,j,k)=sqr(phi(i,j,k));
+            }else{
+               unsigned int p, q, r; assign(tri[t], p, q, r);
+               Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+               phi(i,j,k)=point_triangle_distance2(gx, x[p], x[q], x[r]);
+            }
+         }
+   squared_bricks(bi,bj,bk)=1;
 }
 
-static void sweep(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+// sweep the grid in direction (DI,DJ,DK), processing bricks in dependency order so every
+// cell still sees its upstream neighbours after they were updated; the result is the same
+// as a plain k-j-i sweep. A brick only reads the bricks one step upstream of it, so the
+// bricks of a wavefront (those the same number of steps from the first corner) are
+// independent and are swept in parallel, one wavefront after another.
+// brick_changed holds the sweep in which each brick was last improved and brick_visited
+// the sweep in which it was last processed in this direction: a brick is skipped when
+// neither it nor any brick upstream of it changed since then.
+// The direction is a template parameter so each of the eight sweeps gets its own kernel
+// with the neighbour offsets folded into fixed strides. If update is given, the grid was
+// finished before and is being updated (see update_level_set3).
+// returns the number of cells whose distance was improved
+template<int DI, int DJ, int DK>
+static long sweep(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
                   Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
-                  int di, int dj, int dk)
-{
-   int i0, i1;
-   if(di>0){ i0=1; i1=phi.ni; }
-   else{ i0=phi.ni-2; i1=-1; }
-   int j0, j1;
-   if(dj>0){ j0=1; j1=phi.nj; }
-   else{ j0=phi.nj-2; j1=-1; }
-   int k0, k1;
-   if(dk>0){ k0=1; k1=phi.nk; }
-   else{ k0=phi.nk-2; k1=-1; }
-   for(int k=k0; k!=k1; k+=dk) for(int j=j0; j!=j1; j+=dj) for(int i=i0; i!=i1; i+=di){
-      Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j,    k);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j-dj, k);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j-dj, k);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j,    k-dk);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j,    k-dk);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j-dj, k-dk);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j-dj, k-dk);
+                  Array3<int> &brick_changed, Array3<int> &brick_visited, int stamp,
+                  SweepUpdate *update)
+{
+   const int ni=phi.ni, nj=phi.nj, nk=phi.nk;
+   // strides from a cell to its upstream neighbours along each axis
+   const long si=sweep_stride(DI, ni, 1), sj=sweep_stride(DJ, nj, ni), sk=sweep_stride(DK, nk, (long)ni*nj);
+   float *phi_data=&phi.a[0];
+   int *tri_data=&closest_tri.a[0];
+   const char *moved_tri=update ? &update->moved_tri[0] : 0;
+   const int nbi=brick_changed.ni, nbj=brick_changed.nj, nbk=brick_changed.nk;
+   std::atomic<long> updates(0);
+   std::vector<Vec3i> front;
+   for(int f=0; f<nbi+nbj+nbk-2; ++f){
+      // the bricks of wavefront f that need a visit; the bricks upstream of them are
+      // all in earlier wavefronts, so this can be decided before any is swept
+      front.clear();
+      for(int uk=max(0, f-(nbi-1)-(nbj-1)); uk<=min(nbk-1, f); ++uk)
+         for(int uj=max(0, f-uk-(nbi-1)); uj<=min(nbj-1, f-uk); ++uj){
+            int ui=f-uk-uj;
+            int bi=DI>0 ? ui : nbi-1-ui, bj=DJ>0 ? uj : nbj-1-uj, bk=DK>0 ? uk : nbk-1-uk;
+            int latest=-1;
+            for(int ok=0; ok<2; ++ok) for(int oj=0; oj<2; ++oj) for(int oi=0; oi<2; ++oi){
+               int ci=bi-oi*DI, cj=bj-oj*DJ, ck=bk-ok*DK;
+               if(ci>=0 && ci<nbi && cj>=0 && cj<nbj && ck>=0 && ck<nbk)
+                  latest=max(latest, brick_changed(ci,cj,ck));
+            }
+            if(latest<=brick_visited(bi,bj,bk)) continue;
+            brick_visited(bi,bj,bk)=stamp;
+            front.push_back(Vec3i(bi, bj, bk));
+         }
+      parallel_for(0, (int)front.size(), [&](int b){
+         int bi=front[b][0], bj=front[b][1], bk=front[b][2];
+         if(update && !update->squared_bricks(bi,bj,bk))
+            square_brick(tri, x, phi, closest_tri, origin, dx, bi, bj, bk, update->squared_bricks);
+         // a cell whose closest triangle moved may end up closest to any triangle, and keeps
+         // needing to hear of all of them after it takes up one that didn't move, so bricks
+         // with such cells are swept in full
+         const char *brick_moved_tri=(update && update->lost_bricks(bi,bj,bk)) ? 0 : moved_tri;
+         int i0, i1, j0, j1, k0, k1;
+         brick_range(bi, DI, ni, i0, i1);
+         brick_range(bj, DJ, nj, j0, j1);
+         brick_range(bk, DK, nk, k0, k1);
+         long brick_updates=0;
+         for(int k=k0; k!=k1; k+=DK) for(int j=j0; j!=j1; j+=DJ){
+            long n=i0+ni*(j+(long)nj*k);
+            for(int i=i0; i!=i1; i+=DI, n+=DI){
+               Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+               bool changed=false;
+               changed|=check_neighbour(tri, x, phi_data, tri_data, gx, n, n-si, brick_moved_tri);
+               changed|=check_neighbour(tri, x, phi_data, tri_data, gx, n, n-sj, brick_moved_tri);
+               changed|=check_neighbour(tri, x, phi_data, tri_data, gx, n, n-si-sj, brick_moved_tri);
+               changed|=check_neighbour(tri, x, phi_data, tri_data, gx, n, n-sk, brick_moved_tri);
+               changed|=check_neighbour(tri, x, phi_data, tri_data, gx, n, n-si-sk, brick_moved_tri);
+               changed|=check_neighbour(tri, x, phi_data, tri_data, gx, n, n-sj-sk, brick_moved_tri);
+               changed|=check_neighbour(tri, x, phi_data, tri_data, gx, n, n-si-sj-sk, brick_moved_tri);
+               if(changed) ++brick_updates;
+            }
+         }
+         if(brick_updates>0){
+            brick_changed(bi,bj,bk)=stamp;
+            updates+=brick_updates;
+         }
+      });
    }
+   return updates;
 }
 
+typedef long (*SweepKernel)(const std::vector<Vec3ui> &, const std::vector<Vec3f> &,
+                            Array3f &, Array3i &, const Vec3f &, float,
+                            Array3<int> &, Array3<int> &, int, SweepUpdate *);
+
+// the eight sweep directions, in the order they are cycled through
+static const SweepKernel sweep_kernels[8]={
+   sweep<+1,+1,+1>, sweep<-1,-1,-1>, sweep<+1,+1,-1>, sweep<-1,-1,+1>,
+   sweep<+1,-1,+1>, sweep<-1,+1,-1>, sweep<+1,-1,-1>, sweep<-1,+1,+1>
+};
+
 // calculate twice signed area of triangle (0,0)-(x1,y1)-(x2,y2)
 // return an SOS-determined sign (-1, +1, or 0 only if it's a truly degenerate triangle)
 static int orientation(double x1, double y1, double x2, double y2, double &twice_signed_area)
@@ -115,70 +252,860 @@ static bool point_in_triangle_2d(double x0, double y0,
    return true;
 }
 
-void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
-                     const Vec3f &origin, float dx, int ni, int nj, int nk,
-                     Array3f &phi, const int exact_band)
+// find the slab of grid points within exact_band cells of the plane through the triangle
+// p-q-r (given in grid coordinates): point g is in the slab when 0 <= dot(n,g)-lo <= width.
+// A degenerate triangle gets n=0, in which case the slab contains every point.
+static void band_slab(double fip, double fjp, double fkp, double fiq, double fjq, double fkq,
+                      double fir, double fjr, double fkr, int exact_band,
+                      double &nx, double &ny, double &nz, double &lo, double &width)
+{
+   double ai=fiq-fip, aj=fjq-fjp, ak=fkq-fkp;
+   double bi=fir-fip, bj=fjr-fjp, bk=fkr-fkp;
+   nx=aj*bk-ak*bj; ny=ak*bi-ai*bk; nz=ai*bj-aj*bi;
+   double len=std::sqrt(nx*nx+ny*ny+nz*nz);
+   if(len<1e-12){
+      nx=ny=nz=lo=width=0;
+      return;
+   }
+   nx/=len; ny/=len; nz/=len;
+   double h=exact_band+1e-6; // pad a little so cells exactly exact_band away are kept
+   lo=nx*fip+ny*fjp+nz*fkp-h;
+   width=2*h;
+}
+
+// clip the row [i0,i1] to the points satisfying 0 <= nx*i+s <= width
+// returns false if nothing is left
+static bool clip_row_to_slab(double nx, double s, double width, int &i0, int &i1)
+{
+   if(std::fabs(nx)<1e-12) // row is parallel to the slab, so it's all in or all out
+      return s>=0 && s<=width;
+   double a=-s/nx, b=(width-s)/nx;
+   if(a>b) std::swap(a, b);
+   if(a>i1 || b<i0) return false;
+   // clamp before converting: for a row nearly parallel to the slab a and b can be
+   // far outside the range of an int
+   i0=(int)std::ceil(max(a, (double)i0));
+   i1=(int)std::floor(min(b, (double)i1));
+   return i0<=i1;
+}
+
+static inline void flip_parity(Array3ull &parity, int i, int j, int k)
+{
+   parity(i>>6, j, k)^=1ull<<(i&63);
+}
+
+// turn the squared distances of one row of ni cells into signed distances in phi_row
+// (which may be sq_row itself): a cell is inside the mesh if the parity of intersections
+// up to and including it is odd. The running parity is found a word at a time with a
+// prefix XOR, then applied by flipping the float sign bits so the inner loop has no
+// branches.
+static void apply_row_signs(const float *sq_row, float *phi_row, const unsigned long long *parity_row, int ni)
+{
+   unsigned long long carry=0; // all ones if the parity before this word is odd
+   for(int w=0; w*64<ni; ++w){
+      unsigned long long bits=parity_row[w];
+      bits^=bits<<1; bits^=bits<<2; bits^=bits<<4;
+      bits^=bits<<8; bits^=bits<<16; bits^=bits<<32;
+      bits^=carry;
+      carry=(bits>>63) ? ~0ull : 0ull;
+      const float *sq=sq_row+w*64;
+      float *cell=phi_row+w*64;
+      int n=min(64, ni-w*64);
+      for(int b=0; b<n; ++b){
+         float d=std::sqrt(sq[b]);
+         unsigned int u; std::memcpy(&u, &d, sizeof(u));
+         u^=(unsigned int)((bits>>b)&1)<<31;
+         std::memcpy(&cell[b], &u, sizeof(u));
+      }
+   }
+}
+
+// set up phi and the scratch grids for an ni x nj x nk grid, with every (squared)
+// distance at the square of upper_bound
+static void init_level_set(int ni, int nj, int nk, float upper_bound, Array3f &phi,
+                           LevelSetScratch &scratch, bool unsigned_distance)
 {
    phi.resize(ni, nj, nk);
-   phi.assign((ni+nj+nk)*dx); // upper bound on distance
-   Array3i closest_tri(ni, nj, nk, -1);
-   Array3i intersection_count(ni, nj, nk, 0); // intersection_count(i,j,k) is # of tri intersections in (i-1,i]x{j}x{k}
-   // we begin by initializing distances near the mesh, and figuring out intersection counts
-   Vec3f ijkmin, ijkmax;
-   for(unsigned int t=0; t<tri.size(); ++t){
-     unsigned int p, q, r; assign(tri[t], p, q, r);
-     // coordinates in grid to high precision
-      double fip=((double)x[p][0]-origin[0])/dx, fjp=((double)x[p][1]-origin[1])/dx, fkp=((double)x[p][2]-origin[2])/dx;
-      double fiq=((double)x[q][0]-origin[0])/dx, fjq=((double)x[q][1]-origin[1])/dx, fkq=((double)x[q][2]-origin[2])/dx;
-      double fir=((double)x[r][0]-origin[0])/dx, fjr=((double)x[r][1]-origin[1])/dx, fkr=((double)x[r][2]-origin[2])/dx;
-      // do distances nearby
-      int i0=clamp(int(min(fip,fiq,fir))-exact_band, 0, ni-1), i1=clamp(int(max(fip,fiq,fir))+exact_band+1, 0, ni-1);
-      int j0=clamp(int(min(fjp,fjq,fjr))-exact_band, 0, nj-1), j1=clamp(int(max(fjp,fjq,fjr))+exact_band+1, 0, nj-1);
-      int k0=clamp(int(min(fkp,fkq,fkr))-exact_band, 0, nk-1), k1=clamp(int(max(fkp,fkq,fkr))+exact_band+1, 0, nk-1);
-      for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j) for(int i=i0; i<=i1; ++i){
+   phi.assign(sqr(upper_bound));
+   scratch.closest_tri.resize(ni, nj, nk);
+   scratch.closest_tri.assign(-1);
+   // bit i%64 of intersection_parity(i/64,j,k) is the parity of the # of tri intersections in (i-1,i]x{j}x{k}
+   // (not needed at all for unsigned distances)
+   if(!unsigned_distance){
+      scratch.intersection_parity.resize((ni+63)/64, nj, nk);
+      scratch.intersection_parity.set_zero();
+   }
+}
+
+// find the coordinates of the corners of triangle t in the grid, to high precision
+static void grid_coordinates(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, unsigned int t,
+                             const Vec3f &origin, float dx, double fi[3], double fj[3], double fk[3])
+{
+   for(int c=0; c<3; ++c){
+      const Vec3f &v=x[tri[t][c]];
+      fi[c]=((double)v[0]-origin[0])/dx;
+      fj[c]=((double)v[1]-origin[1])/dx;
+      fk[c]=((double)v[2]-origin[2])/dx;
+   }
+}
+
+// initialize the distances of the cells within exact_band cells of triangle t, in the
+// layers [k_begin,k_end) only if those are given
+static void rasterize_triangle(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, unsigned int t,
+                               const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri,
+                               int exact_band, int k_begin=0, int k_end=INT_MAX)
+{
+   int ni=phi.ni, nj=phi.nj, nk=phi.nk;
+   unsigned int p, q, r; assign(tri[t], p, q, r);
+   double fi[3], fj[3], fk[3];
+   grid_coordinates(tri, x, t, origin, dx, fi, fj, fk);
+   int i0=clamp(int(min(fi[0],fi[1],fi[2]))-exact_band, 0, ni-1), i1=clamp(int(max(fi[0],fi[1],fi[2]))+exact_band+1, 0, ni-1);
+   int j0=clamp(int(min(fj[0],fj[1],fj[2]))-exact_band, 0, nj-1), j1=clamp(int(max(fj[0],fj[1],fj[2]))+exact_band+1, 0, nj-1);
+   int k0=clamp(int(min(fk[0],fk[1],fk[2]))-exact_band, 0, nk-1), k1=clamp(int(max(fk[0],fk[1],fk[2]))+exact_band+1, 0, nk-1);
+   k0=max(k0, k_begin);
+   k1=min(k1, k_end-1);
+   // but only visit the cells of that box which are within exact_band cells of the
+   // triangle's plane, so the work scales with the triangle's area rather than its volume
+   double nx, ny, nz, lo, width;
+   band_slab(fi[0], fj[0], fk[0], fi[1], fj[1], fk[1], fi[2], fj[2], fk[2], exact_band, nx, ny, nz, lo, width);
+   for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j){
+      int ilo=i0, ihi=i1;
+      if(!clip_row_to_slab(nx, ny*j+nz*k-lo, width, ilo, ihi)) continue;
+      for(int i=ilo; i<=ihi; ++i){
          Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
-         float d=point_triangle_distance(gx, x[p], x[q], x[r]);
+         float d=point_triangle_distance2(gx, x[p], x[q], x[r]);
          if(d<phi(i,j,k)){
             phi(i,j,k)=d;
             closest_tri(i,j,k)=t;
          }
       }
-      // and do intersection counts
-      j0=clamp((int)std::ceil(min(fjp,fjq,fjr)), 0, nj-1);
-      j1=clamp((int)std::floor(max(fjp,fjq,fjr)), 0, nj-1);
-      k0=clamp((int)std::ceil(min(fkp,fkq,fkr)), 0, nk-1);
-      k1=clamp((int)std::floor(max(fkp,fkq,fkr)), 0, nk-1);
-      for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j){
-         double a, b, c;
-         if(point_in_triangle_2d(j, k, fjp, fkp, fjq, fkq, fjr, fkr, a, b, c)){
-            double fi=a*fip+b*fiq+c*fir; // intersection i coordinate
-            int i_interval=int(std::ceil(fi)); // intersection is in (i_interval-1,i_interval]
-            if(i_interval<0) ++intersection_count(0, j, k); // we enlarge the first interval to include everything to the -x direction
-            else if(i_interval<ni) ++intersection_count(i_interval,j,k);
-            // we ignore intersections that are beyond the +x side of the grid
-         }
+   }
+}
+
+// mark the sweep bricks holding cells within reach cells of triangle t's bounding box
+static void mark_near_bricks(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, unsigned int t,
+                             const Vec3f &origin, float dx, float reach, Array3<char> &bricks)
+{
+   double fi[3], fj[3], fk[3];
+   grid_coordinates(tri, x, t, origin, dx, fi, fj, fk);
+   int b0[3], b1[3], nb[3]={bricks.ni, bricks.nj, bricks.nk};
+   const double *f[3]={fi, fj, fk};
+   for(int a=0; a<3; ++a){
+      double lo=min(f[a][0], f[a][1], f[a][2])-reach, hi=max(f[a][0], f[a][1], f[a][2])+reach;
+      double n=nb[a]*(double)sweep_brick;
+      if(hi<0 || lo>=n) return; // the box misses the grid
+      b0[a]=(int)(max(lo, 0.)/sweep_brick);
+      b1[a]=(int)(min(hi, n-1)/sweep_brick);
+   }
+   for(int bk=b0[2]; bk<=b1[2]; ++bk) for(int bj=b0[1]; bj<=b1[1]; ++bj) for(int bi=b0[0]; bi<=b1[0]; ++bi)
+      bricks(bi,bj,bk)=1;
+}
+
+// flip the parity of every cell whose interval (i-1,i] along x is crossed by triangle t,
+// in a grid with ni cells along x (in the layers [k_begin,k_end) only if those are given)
+static void count_intersections(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, unsigned int t,
+                                const Vec3f &origin, float dx, int ni, Array3ull &intersection_parity,
+                                int k_begin=0, int k_end=INT_MAX)
+{
+   int nj=intersection_parity.nj, nk=intersection_parity.nk;
+   double fi[3], fj[3], fk[3];
+   grid_coordinates(tri, x, t, origin, dx, fi, fj, fk);
+   // skip triangles that miss every row, or lie entirely beyond the +x side of the grid
+   if(max(fj[0],fj[1],fj[2])<0 || min(fj[0],fj[1],fj[2])>nj-1 ||
+      max(fk[0],fk[1],fk[2])<0 || min(fk[0],fk[1],fk[2])>nk-1 ||
+      min(fi[0],fi[1],fi[2])>ni) return;
+   int j0=clamp((int)std::ceil(min(fj[0],fj[1],fj[2])), 0, nj-1);
+   int j1=clamp((int)std::floor(max(fj[0],fj[1],fj[2])), 0, nj-1);
+   int k0=clamp((int)std::ceil(min(fk[0],fk[1],fk[2])), 0, nk-1);
+   int k1=clamp((int)std::floor(max(fk[0],fk[1],fk[2])), 0, nk-1);
+   k0=max(k0, k_begin);
+   k1=min(k1, k_end-1);
+   for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j){
+      double a, b, c;
+      if(point_in_triangle_2d(j, k, fj[0], fk[0], fj[1], fk[1], fj[2], fk[2], a, b, c)){
+         double f=a*fi[0]+b*fi[1]+c*fi[2]; // intersection i coordinate
+         int i_interval=int(std::ceil(f)); // intersection is in (i_interval-1,i_interval]
+         if(i_interval<0) flip_parity(intersection_parity, 0, j, k); // we enlarge the first interval to include everything to the -x direction
+         else if(i_interval<ni) flip_parity(intersection_parity, i_interval, j, k);
+         // we ignore intersections that are beyond the +x side of the grid
       }
    }
-   // and now we fill in the rest of the distances with fast sweeping
-   for(unsigned int pass=0; pass<2; ++pass){
-      sweep(tri, x, phi, closest_tri, origin, dx, +1, +1, +1);
-      sweep(tri, x, phi, closest_tri, origin, dx, -1, -1, -1);
-      sweep(tri, x, phi, closest_tri, origin, dx, +1, +1, -1);
-      sweep(tri, x, phi, closest_tri, origin, dx, -1, -1, +1);
-      sweep(tri, x, phi, closest_tri, origin, dx, +1, -1, +1);
-      sweep(tri, x, phi, closest_tri, origin, dx, -1, +1, -1);
-      sweep(tri, x, phi, closest_tri, origin, dx, +1, -1, -1);
-      sweep(tri, x, phi, closest_tri, origin, dx, -1, +1, +1);
+}
+
+// Rasterization and intersection counting run in parallel over slabs of layers along k:
+// each triangle is listed in every slab its cells can reach and is clipped to the slab
+// there. A slab visits its triangles in ascending order, so every cell sees the same
+// updates in the same order as a serial pass and the result doesn't change.
+static void rasterize_slabs(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                            const Vec3f &origin, float dx, Array3f &phi, LevelSetScratch &scratch,
+                            int exact_band, bool unsigned_distance)
+{
+   int ni=phi.ni, nk=phi.nk;
+   int n_slabs=min(nk, 4*(TaskScheduler::instance().size()+1));
+   int slab_k=(nk+n_slabs-1)/n_slabs;
+   n_slabs=(nk+slab_k-1)/slab_k;
+   // the slabs [s0,s1] each triangle reaches, found in parallel, then the lists in order
+   std::vector<int> first_slab(tri.size()), last_slab(tri.size());
+   parallel_for(0, (int)((tri.size()+4095)/4096), [&](int b){
+      unsigned int t1=(unsigned int)min(tri.size(), (size_t)(b+1)*4096);
+      for(unsigned int t=(unsigned int)b*4096; t<t1; ++t){
+         double fi[3], fj[3], fk[3];
+         grid_coordinates(tri, x, t, origin, dx, fi, fj, fk);
+         // clamped like the layers the kernels visit, which include the nearest
+         // boundary layer even for a triangle beyond the grid
+         double lo=std::floor(min(fk[0],fk[1],fk[2]))-exact_band, hi=std::ceil(max(fk[0],fk[1],fk[2]))+exact_band+1;
+         first_slab[t]=(int)clamp(lo, 0., nk-1.)/slab_k;
+         last_slab[t]=(int)clamp(hi, 0., nk-1.)/slab_k;
+      }
+   });
+   std::vector<std::vector<unsigned int> > slabs(n_slabs);
+   for(unsigned int t=0; t<tri.size(); ++t)
+      for(int b=first_slab[t]; b<=last_slab[t]; ++b) slabs[b].push_back(t);
+   parallel_for(0, n_slabs, [&](int b){
+      int k_begin=b*slab_k, k_end=min(nk, (b+1)*slab_k);
+      const std::vector<unsigned int> &list=slabs[b];
+      for(size_t n=0; n<list.size(); ++n){
+         rasterize_triangle(tri, x, list[n], origin, dx, phi, scratch.closest_tri, exact_band, k_begin, k_end);
+         if(!unsigned_distance)
+            count_intersections(tri, x, list[n], origin, dx, ni, scratch.intersection_parity, k_begin, k_end);
+      }
+   });
+}
+
+// fill in the rest of the distances with fast sweeping, cycling through the eight
+// directions. A sweep that changes nothing leaves the grid as it was, so once eight
+// sweeps in a row have made no update every direction is converged and we can stop
+// early. If active_bricks is given, only the sweep bricks marked in it are swept.
+// If update is given, sweeping starts from the bricks it marks as changed instead of
+// from every brick. Returns the number of rounds used.
+static int sweep_level_set(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                           const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri,
+                           int max_iterations, const Array3<char> *active_bricks=0,
+                           SweepUpdate *update=0)
+{
+   int nbi=(phi.ni+sweep_brick-1)/sweep_brick, nbj=(phi.nj+sweep_brick-1)/sweep_brick, nbk=(phi.nk+sweep_brick-1)/sweep_brick;
+   Array3<int> brick_changed(nbi, nbj, nbk, 0); // rasterization counts as sweep 0
+   if(update) brick_changed=update->brick_changed;
+   std::vector<Array3<int> > brick_visited(8, Array3<int>(nbi, nbj, nbk, -1));
+   if(active_bricks){
+      // an inactive brick looks as if it had been visited after any possible change
+      for(int d=0; d<8; ++d) for(int bk=0; bk<nbk; ++bk) for(int bj=0; bj<nbj; ++bj) for(int bi=0; bi<nbi; ++bi)
+         if(!(*active_bricks)(bi,bj,bk)) brick_visited[d](bi,bj,bk)=std::numeric_limits<int>::max();
+   }
+   int n_sweeps=0, idle_sweeps=0;
+   while(n_sweeps<8*max_iterations && idle_sweeps<8){
+      if(sweep_kernels[n_sweeps%8](tri, x, phi, closest_tri, origin, dx,
+                                   brick_changed, brick_visited[n_sweeps%8], n_sweeps+1,
+                                   update)>0) idle_sweeps=0;
+      else ++idle_sweeps;
+      ++n_sweeps;
+   }
+   return (n_sweeps+7)/8;
+}
+
+// IEEE half precision bits of f, rounded to nearest even (F. Giesen's branch-light
+// conversion: the float unit does the rounding of subnormals, and a bias trick the rest)
+static inline unsigned short float_to_half(float f)
+{
+   unsigned int u; std::memcpy(&u, &f, sizeof(u));
+   unsigned int sign=u&0x80000000u;
+   u^=sign;
+   unsigned short h;
+   if(u>=(127u+16)<<23){ // too large for a half: infinity (or NaN)
+      h=u>0x7f800000u ? 0x7e00 : 0x7c00;
+   }else if(u<113u<<23){ // a half subnormal, or zero
+      const unsigned int magic_bits=((127u-15)+(23-10)+1)<<23;
+      float magic; std::memcpy(&magic, &magic_bits, sizeof(magic));
+      float g; std::memcpy(&g, &u, sizeof(g));
+      g+=magic;
+      std::memcpy(&u, &g, sizeof(u));
+      h=(unsigned short)(u-magic_bits);
+   }else{
+      unsigned int mantissa_odd=(u>>13)&1;
+      u+=((unsigned int)(15-127)<<23)+0xfff+mantissa_odd;
+      h=(unsigned short)(u>>13);
+   }
+   return h|(unsigned short)(sign>>16);
+}
+
+template<class T>
+static void store_rounded(const float *d, int n, float truncation, float scale, float limit, T *dest)
+{
+   for(int i=0; i<n; ++i){
+      float v=d[i];
+      if(truncation>0) v=max(-truncation, min(truncation, v));
+      v=max(-limit, min(limit, v*scale));
+      dest[i]=(T)std::nearbyint(v);
+   }
+}
+
+// write the n distances d as samples first..first+n-1 of out
+static void store_row(const float *d, int n, const LevelSetOutput &out, size_t first)
+{
+   const float t=out.truncation, s=out.scale;
+   switch(out.dtype){
+   case level_set_float32:
+   {
+      float *dest=(float*)out.data+first;
+      for(int i=0; i<n; ++i) dest[i]=(t>0 ? max(-t, min(t, d[i])) : d[i])*s;
+      break;
+   }
+   case level_set_float16:
+   {
+      unsigned short *dest=(unsigned short*)out.data+first;
+      for(int i=0; i<n; ++i) dest[i]=float_to_half((t>0 ? max(-t, min(t, d[i])) : d[i])*s);
+      break;
+   }
+   case level_set_int16:
+      store_rounded(d, n, t, s, 32767.f, (short*)out.data+first);
+      break;
+   case level_set_int8:
+      store_rounded(d, n, t, s, 127.f, (signed char*)out.data+first);
+      break;
+   }
+}
+
+// take square roots and figure out signs (inside/outside) from intersection parities,
+// in place or, if out is given, into it a row at a time
+static void finish_level_set(Array3f &phi, const Array3ull &intersection_parity, bool unsigned_distance,
+                             const LevelSetOutput *out=0)
+{
+   int ni=phi.ni, nj=phi.nj, nk=phi.nk;
+   if(out){
+      parallel_for(0, nk, [&](int k){
+         std::vector<float> row(ni);
+         for(int j=0; j<nj; ++j){
+            if(unsigned_distance) for(int i=0; i<ni; ++i) row[i]=std::sqrt(phi(i,j,k));
+            else apply_row_signs(&phi(0,j,k), &row[0], &intersection_parity(0,j,k), ni);
+            store_row(&row[0], ni, *out, ni*(j+(size_t)nj*k));
+         }
+      });
+   }else if(unsigned_distance){
+      parallel_for(0, nk, [&](int k){
+         for(int j=0; j<nj; ++j) for(int i=0; i<ni; ++i)
+            phi(i,j,k)=std::sqrt(phi(i,j,k));
+      });
+   }else{
+      parallel_for(0, nk, [&](int k){
+         for(int j=0; j<nj; ++j)
+            apply_row_signs(&phi(0,j,k), &phi(0,j,k), &intersection_parity(0,j,k), ni);
+      });
+   }
+}
+
+void convert_level_set3(const float *phi, size_t n, const LevelSetOutput &out)
+{
+   const int block=1<<16;
+   parallel_for(0, (int)((n+block-1)/block), [&](int b){
+      size_t first=(size_t)b*block;
+      store_row(phi+first, (int)min((size_t)block, n-first), out, first);
+   });
+}
+
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, int ni, int nj, int nk,
+                    Array3f &phi, const int exact_band, const int max_iterations,
+                    const bool unsigned_distance, const float truncation)
+{
+   LevelSetScratch scratch;
+   return make_level_set3(tri, x, origin, dx, ni, nj, nk, phi, scratch,
+                          exact_band, max_iterations, unsigned_distance, truncation);
+}
+
+// the full grid, finished into phi or out
+static int grid_level_set(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                          const Vec3f &origin, float dx, int ni, int nj, int nk,
+                          Array3f &phi, LevelSetScratch &scratch, int exact_band,
+                          int max_iterations, bool unsigned_distance, float truncation,
+                          const LevelSetOutput *out)
+{
+   float upper_bound=(ni+nj+nk)*dx; // on any distance in the grid
+   if(truncation>0) upper_bound=min(upper_bound, truncation);
+   init_level_set(ni, nj, nk, upper_bound, phi, scratch, unsigned_distance);
+   // when truncating, only the bricks within truncation of some triangle get swept
+   int nbi=(ni+sweep_brick-1)/sweep_brick, nbj=(nj+sweep_brick-1)/sweep_brick, nbk=(nk+sweep_brick-1)/sweep_brick;
+   Array3<char> near_bricks;
+   if(truncation>0) near_bricks.resize(nbi, nbj, nbk, (char)0);
+   // we begin by initializing distances near the mesh, and figuring out intersection counts
+   rasterize_slabs(tri, x, origin, dx, phi, scratch, exact_band, unsigned_distance);
+   if(truncation>0){
+      for(unsigned int t=0; t<tri.size(); ++t)
+         mark_near_bricks(tri, x, t, origin, dx, truncation/dx, near_bricks);
    }
+   // and now we fill in the rest of the distances with fast sweeping
+   int rounds=sweep_level_set(tri, x, origin, dx, phi, scratch.closest_tri, max_iterations,
+                              truncation>0 ? &near_bricks : 0);
    // then figure out signs (inside/outside) from intersection counts
-   for(int k=0; k<nk; ++k) for(int j=0; j<nj; ++j){
-      int total_count=0;
-      for(int i=0; i<ni; ++i){
-         total_count+=intersection_count(i,j,k);
-         if(total_count%2==1){ // if parity of intersections so far is odd,
-            phi(i,j,k)=-phi(i,j,k); // we are inside the mesh
+   finish_level_set(phi, scratch.intersection_parity, unsigned_distance, out);
+   return rounds;
+}
+
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, int ni, int nj, int nk,
+                    Array3f &phi, LevelSetScratch &scratch, const int exact_band,
+                    const int max_iterations, const bool unsigned_distance,
+                    const float truncation)
+{
+   return grid_level_set(tri, x, origin, dx, ni, nj, nk, phi, scratch, exact_band,
+                         max_iterations, unsigned_distance, truncation, 0);
+}
+
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, int ni, int nj, int nk,
+                    const LevelSetOutput &out, Array3f &phi, LevelSetScratch &scratch,
+                    const int exact_band, const int max_iterations, const bool unsigned_distance,
+                    const float truncation)
+{
+   return grid_level_set(tri, x, origin, dx, ni, nj, nk, phi, scratch, exact_band,
+                         max_iterations, unsigned_distance, truncation, &out);
+}
+
+// the ROI seeds every roi_seed_stride-th cell along its faces (and the last one)
+static const int roi_seed_stride=2;
+
+static inline bool on_seed_lattice(int c, int n)
+{
+   return c%roi_seed_stride==0 || c==n-1;
+}
+
+// A coarse uniform grid of bins over a set of triangles, each listed in every bin its
+// bounding box overlaps, for finding the triangle closest to a point, or the triangles
+// near a box, without trying them all
+struct TriangleBins
+{
+   Vec3f origin;
+   float h;                          // side of a bin
+   int n[3];                         // bins along each axis
+   std::vector<unsigned int> first;  // bin b lists entries [first[b], first[b+1])
+   std::vector<unsigned int> entry;  // indices into the triangle set
+   std::vector<Vec3i> range;         // the first and last bin of each triangle (2t, 2t+1)
+
+   // box holds the min and max corners of each triangle of the set (at 2t and 2t+1)
+   explicit TriangleBins(const std::vector<Vec3f> &box)
+   {
+      unsigned int n_tri=(unsigned int)(box.size()/2);
+      Vec3f lo(0.f), hi(0.f);
+      if(n_tri>0){ lo=box[0]; hi=box[1]; }
+      for(unsigned int t=1; t<n_tri; ++t){ update_minmax(box[2*t], lo, hi); update_minmax(box[2*t+1], lo, hi); }
+      // about as many bins as triangles in the cube on the longest side (at most 64 a
+      // side), but coarser while large triangles would be listed too many times
+      origin=lo;
+      for(int longest=clamp((int)std::cbrt((double)n_tri), 1, 64); ; longest=(longest+1)/2){
+         h=max(max(hi-lo)/longest, 1e-30f);
+         for(int a=0; a<3; ++a) n[a]=clamp((int)std::ceil((hi[a]-lo[a])/h), 1, 64);
+         double entries=0;
+         for(unsigned int t=0; t<n_tri; ++t){
+            Vec3i b0=bin_of(box[2*t]), b1=bin_of(box[2*t+1]);
+            entries+=(double)(b1[0]-b0[0]+1)*(b1[1]-b0[1]+1)*(b1[2]-b0[2]+1);
+         }
+         if(longest==1 || entries<=16.*n_tri) break;
+      }
+      range.resize(2*n_tri);
+      first.assign((size_t)n[0]*n[1]*n[2]+1, 0);
+      for(unsigned int t=0; t<n_tri; ++t){
+         range[2*t]=bin_of(box[2*t]);
+         range[2*t+1]=bin_of(box[2*t+1]);
+         for_bins(range[2*t], range[2*t+1], [&](size_t b){ ++first[b+1]; });
+      }
+      for(size_t b=1; b<first.size(); ++b) first[b]+=first[b-1];
+      entry.resize(first.back());
+      std::vector<unsigned int> fill(first.begin(), first.end()-1);
+      for(unsigned int t=0; t<n_tri; ++t)
+         for_bins(range[2*t], range[2*t+1], [&](size_t b){ entry[fill[b]++]=t; });
+   }
+
+   Vec3i bin_of(const Vec3f &p) const
+   {
+      Vec3i c;
+      for(int a=0; a<3; ++a) c[a]=(int)clamp(std::floor((p[a]-origin[a])/h), 0.f, (float)(n[a]-1));
+      return c;
+   }
+
+   template<class F>
+   void for_bins(const Vec3i &b0, const Vec3i &b1, const F &f) const
+   {
+      for(int k=b0[2]; k<=b1[2]; ++k) for(int j=b0[1]; j<=b1[1]; ++j) for(int i=b0[0]; i<=b1[0]; ++i)
+         f(i+(size_t)n[0]*(j+(size_t)n[1]*k));
+   }
+
+   // set flag in marks[t] for the triangles t of the set listed in the bins the box
+   // [lo, hi] overlaps, which include every triangle whose bounding box overlaps it
+   void gather(const Vec3f &lo, const Vec3f &hi, char flag, std::vector<char> &marks) const
+   {
+      for_bins(bin_of(lo), bin_of(hi), [&](size_t b){
+         for(unsigned int e=first[b]; e<first[b+1]; ++e) marks[entry[e]]|=flag;
+      });
+   }
+
+   // the triangle of the set closest to p and its squared distance, found by visiting
+   // rings of bins around p until no triangle outside them can be closer; ties go to
+   // the lowest index, as they would trying the triangles in order. set maps the set's
+   // triangles to indices into tri, or is null if the set is all of tri.
+   void closest(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                const std::vector<unsigned int> *set, const Vec3f &p,
+                float &best_d, unsigned int &best_t) const
+   {
+      best_d=std::numeric_limits<float>::max();
+      best_t=0;
+      Vec3i c=bin_of(p);
+      for(int r=0; ; ++r){
+         Vec3i b0, b1, prev0, prev1;
+         for(int a=0; a<3; ++a){
+            b0[a]=max(c[a]-r, 0); b1[a]=min(c[a]+r, n[a]-1);
+            prev0[a]=max(c[a]-r+1, 0); prev1[a]=min(c[a]+r-1, n[a]-1);
+         }
+         // the bins of this ring: those of its box not in the previous ring's box
+         for(int k=b0[2]; k<=b1[2]; ++k) for(int j=b0[1]; j<=b1[1]; ++j){
+            bool inner=(k>=prev0[2] && k<=prev1[2] && j>=prev0[1] && j<=prev1[1]);
+            for(int i=b0[0]; i<=b1[0]; ++i){
+               if(inner && i==prev0[0]) i=prev1[0]+1;
+               if(i>b1[0]) break;
+               size_t b=i+(size_t)n[0]*(j+(size_t)n[1]*k);
+               for(unsigned int e=first[b]; e<first[b+1]; ++e){
+                  unsigned int t=entry[e];
+                  // try each triangle once: at the first ring that reaches it, and there
+                  // only in the lowest of its bins inside the ring's box
+                  bool seen=r>0;
+                  Vec3i own;
+                  for(int a=0; a<3; ++a){
+                     seen=seen && range[2*t][a]<=prev1[a] && range[2*t+1][a]>=prev0[a];
+                     own[a]=max(range[2*t][a], b0[a]);
+                  }
+                  if(seen || own[0]+(size_t)n[0]*(own[1]+(size_t)n[1]*own[2])!=b) continue;
+                  unsigned int s=set ? (*set)[t] : t;
+                  unsigned int q, u, v; assign(tri[s], q, u, v);
+                  float d=point_triangle_distance2(p, x[q], x[u], x[v]);
+                  if(d<best_d || (d==best_d && s<best_t)){ best_d=d; best_t=s; }
+               }
+            }
+         }
+         // any triangle not tried yet lies beyond one of the open faces of this ring's box
+         // (less a little, for rounding in which bins the triangles were put)
+         float bound=std::numeric_limits<float>::max();
+         for(int a=0; a<3; ++a){
+            if(b0[a]>0) bound=min(bound, p[a]-(origin[a]+b0[a]*h));
+            if(b1[a]<n[a]-1) bound=min(bound, origin[a]+(b1[a]+1)*h-p[a]);
+         }
+         if(bound==std::numeric_limits<float>::max()) return;
+         bound-=1e-3f*h;
+         if(bound>0 && sqr(bound)>best_d) return;
+      }
+   }
+};
+
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, const Vec3i &roi_min, const Vec3i &roi_max,
+                    Array3f &phi, const int exact_band, const int max_iterations,
+                    const bool unsigned_distance)
+{
+   LevelSetScratch scratch;
+   return make_level_set3(tri, x, origin, dx, roi_min, roi_max, phi, scratch,
+                          exact_band, max_iterations, unsigned_distance);
+}
+
+// the region of interest version of make_level_set3; mesh, if given, is the preprocessing
+// of tri and x, whose triangle boxes needn't be found again and whose bins narrow down the
+// triangles near the ROI and those crossing its rows
+static int roi_level_set(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                         const LevelSetMesh *mesh, const Vec3f &origin, float dx,
+                         const Vec3i &roi_min, const Vec3i &roi_max, Array3f &phi,
+                         LevelSetScratch &scratch, int exact_band, int max_iterations,
+                         bool unsigned_distance)
+{
+   int ni=roi_max[0]-roi_min[0], nj=roi_max[1]-roi_min[1], nk=roi_max[2]-roi_min[2];
+   assert(ni>0 && nj>0 && nk>0);
+   // the ROI is computed as a grid of its own, whose first cell is at roi_min
+   Vec3f roi_origin(origin[0]+roi_min[0]*dx, origin[1]+roi_min[1]*dx, origin[2]+roi_min[2]*dx);
+   Vec3f lo(roi_origin), hi(roi_origin+dx*Vec3f((float)(ni-1), (float)(nj-1), (float)(nk-1)));
+   // every cell of the ROI is at most bound away from the vertex nearest to the ROI's centre,
+   // so a triangle further than that from the ROI's box can't be the closest to any of its cells
+   Vec3f centre=0.5f*(lo+hi);
+   float bound=(ni+nj+nk)*dx; // only used as is if there are no triangles at all
+   if(!tri.empty()){
+      float nearest=std::numeric_limits<float>::max();
+      for(unsigned int t=0; t<tri.size(); ++t) for(int c=0; c<3; ++c)
+         nearest=min(nearest, dist(centre, x[tri[t][c]]));
+      bound=nearest+0.5f*dist(lo, hi)+dx;
+   }
+   init_level_set(ni, nj, nk, bound, phi, scratch, unsigned_distance);
+   // the triangles that may be near the ROI (flag 1) or cross its rows (flag 2): all of
+   // them, unless the mesh's bins can tell (with a cell to spare for rounding)
+   const char may_be_near=1, may_cross=2;
+   std::vector<char> candidate(tri.size(), mesh ? 0 : may_be_near|may_cross);
+   if(mesh){
+      Vec3f margin(bound+dx);
+      mesh->bins->gather(lo-margin, hi+margin, may_be_near, candidate);
+      if(!unsigned_distance){
+         Vec3f row_lo(-std::numeric_limits<float>::max(), lo[1]-dx, lo[2]-dx);
+         mesh->bins->gather(row_lo, hi+Vec3f(dx), may_cross, candidate);
+      }
+   }
+   std::vector<unsigned int> near_tri;
+   std::vector<Vec3f> near_box;
+   for(unsigned int t=0; t<tri.size(); ++t){
+      if(!candidate[t]) continue;
+      Vec3f tmin, tmax;
+      if(mesh){
+         tmin=mesh->tri_box[2*t]; tmax=mesh->tri_box[2*t+1];
+      }else{
+         unsigned int p, q, r; assign(tri[t], p, q, r);
+         minmax(x[p], x[q], x[r], tmin, tmax);
+      }
+      float d2=0;
+      for(int a=0; a<3; ++a) d2+=sqr(max(0.f, tmin[a]-hi[a], lo[a]-tmax[a]));
+      if((candidate[t]&may_be_near) && d2<=sqr(bound)){
+         near_tri.push_back(t);
+         near_box.push_back(tmin);
+         near_box.push_back(tmax);
+         rasterize_triangle(tri, x, t, roi_origin, dx, phi, scratch.closest_tri, exact_band);
+      }
+      // signs still count every intersection from the -x edge of the domain, whatever the
+      // distance; count_intersections itself skips triangles that miss the ROI's rows
+      if(!unsigned_distance && (candidate[t]&may_cross))
+         count_intersections(tri, x, t, roi_origin, dx, ni, scratch.intersection_parity);
+   }
+   // the closest triangle of a cell may lie outside the ROI with its band never reaching
+   // it, so seed a lattice of cells on the ROI's faces with their exact distance to give
+   // the sweeps that information (and something to propagate at all where no band is);
+   // the near triangles are binned (or the mesh's bins used) so each seed only tries
+   // those around it
+   if(!near_tri.empty()){
+      std::unique_ptr<TriangleBins> near_bins;
+      if(!mesh) near_bins.reset(new TriangleBins(near_box));
+      parallel_for(0, nk, [&](int k){
+         bool k_face=(k==0 || k==nk-1);
+         if(!on_seed_lattice(k, nk)) return;
+         for(int j=0; j<nj; ++j){
+            if(!on_seed_lattice(j, nj)) continue;
+            // the whole row on a k or j face, otherwise its two ends
+            int step=(k_face || j==0 || j==nj-1) ? 1 : max(ni-1, 1);
+            for(int i=0; i<ni; i+=step){
+               if(!on_seed_lattice(i, ni)) continue;
+               Vec3f gx(i*dx+roi_origin[0], j*dx+roi_origin[1], k*dx+roi_origin[2]);
+               float d;
+               unsigned int t;
+               if(mesh) mesh->bins->closest(tri, x, 0, gx, d, t);
+               else near_bins->closest(tri, x, &near_tri, gx, d, t);
+               if(d<phi(i,j,k)){
+                  phi(i,j,k)=d;
+                  scratch.closest_tri(i,j,k)=t;
+               }
+            }
+         }
+      });
+   }
+   int rounds=sweep_level_set(tri, x, roi_origin, dx, phi, scratch.closest_tri, max_iterations);
+   finish_level_set(phi, scratch.intersection_parity, unsigned_distance);
+   return rounds;
+}
+
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, const Vec3i &roi_min, const Vec3i &roi_max,
+                    Array3f &phi, LevelSetScratch &scratch, const int exact_band,
+                    const int max_iterations, const bool unsigned_distance)
+{
+   return roi_level_set(tri, x, 0, origin, dx, roi_min, roi_max, phi, scratch,
+                        exact_band, max_iterations, unsigned_distance);
+}
+
+LevelSetMesh::LevelSetMesh(const std::vector<Vec3ui> &tri_, const std::vector<Vec3f> &x_)
+   : tri(tri_), x(x_), tri_box(2*tri_.size()), bbox_min(0.f), bbox_max(0.f)
+{
+   for(unsigned int t=0; t<tri.size(); ++t){
+      unsigned int p, q, r; assign(tri[t], p, q, r);
+      minmax(x[p], x[q], x[r], tri_box[2*t], tri_box[2*t+1]);
+   }
+   if(!x.empty()){
+      bbox_min=bbox_max=x[0];
+      for(unsigned int i=1; i<x.size(); ++i) update_minmax(x[i], bbox_min, bbox_max);
+   }
+   bins.reset(new TriangleBins(tri_box));
+}
+
+int make_level_set3(const LevelSetMesh &mesh, const Vec3f &origin, float dx, int ni, int nj, int nk,
+                    Array3f &phi, LevelSetScratch &scratch, const int exact_band,
+                    const int max_iterations, const bool unsigned_distance,
+                    const float truncation)
+{
+   return make_level_set3(mesh.tri, mesh.x, origin, dx, ni, nj, nk, phi, scratch,
+                          exact_band, max_iterations, unsigned_distance, truncation);
+}
+
+int make_level_set3(const LevelSetMesh &mesh, const Vec3f &origin, float dx,
+                    const Vec3i &roi_min, const Vec3i &roi_max, Array3f &phi,
+                    LevelSetScratch &scratch, const int exact_band,
+                    const int max_iterations, const bool unsigned_distance)
+{
+   return roi_level_set(mesh.tri, mesh.x, &mesh, origin, dx, roi_min, roi_max, phi,
+                        scratch, exact_band, max_iterations, unsigned_distance);
+}
+
+// find the coarse sample c below fine cell i and the fraction f of the way to c+1,
+// for coarse samples every coarsening fine cells and nc samples in all
+static inline void coarse_position(int i, int coarsening, int nc, int &c, float &f)
+{
+   c=min(i/coarsening, max(nc-2, 0));
+   f=nc>1 ? (float)(i-c*coarsening)/coarsening : 0.f;
+}
+
+int make_level_set3_multires(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                             const Vec3f &origin, float dx, int ni, int nj, int nk,
+                             Array3f &phi, const int coarsening, const int refine_band,
+                             const int exact_band, const int max_iterations,
+                             const bool unsigned_distance)
+{
+   // first the whole field at the coarse resolution, with samples on every coarsening-th fine cell
+   int f=max(coarsening, 1);
+   int nci=(ni-1+f-1)/f+1, ncj=(nj-1+f-1)/f+1, nck=(nk-1+f-1)/f+1;
+   Array3f coarse;
+   LevelSetScratch scratch;
+   make_level_set3(tri, x, origin, f*dx, nci, ncj, nck, coarse, scratch,
+                   exact_band, max_iterations, unsigned_distance);
+   // a sweep brick is refined if any coarse sample covering it says the surface might be
+   // within refine_band fine cells of it: each fine cell is within a coarse cell diagonal
+   // of a covering sample, and we allow another coarse cell for the coarse sweep's error
+   int nbi=(ni+sweep_brick-1)/sweep_brick, nbj=(nj+sweep_brick-1)/sweep_brick, nbk=(nk+sweep_brick-1)/sweep_brick;
+   Array3<char> refine(nbi, nbj, nbk, (char)0);
+   float threshold=(refine_band+f*(std::sqrt(3.f)+1))*dx;
+   for(int bk=0; bk<nbk; ++bk) for(int bj=0; bj<nbj; ++bj) for(int bi=0; bi<nbi; ++bi){
+      int ci0=bi*sweep_brick/f, ci1=min((min((bi+1)*sweep_brick, ni)-1+f-1)/f, nci-1);
+      int cj0=bj*sweep_brick/f, cj1=min((min((bj+1)*sweep_brick, nj)-1+f-1)/f, ncj-1);
+      int ck0=bk*sweep_brick/f, ck1=min((min((bk+1)*sweep_brick, nk)-1+f-1)/f, nck-1);
+      for(int ck=ck0; ck<=ck1 && !refine(bi,bj,bk); ++ck) for(int cj=cj0; cj<=cj1; ++cj) for(int ci=ci0; ci<=ci1; ++ci){
+         if(std::fabs(coarse(ci,cj,ck))<=threshold){
+            refine(bi,bj,bk)=1;
+            break;
          }
       }
    }
+   // then the fine resolution in the refined bricks: rasterization and intersection counts
+   // are cheap (they scale with the surface), it's the sweeping that is restricted
+   init_level_set(ni, nj, nk, (ni+nj+nk)*dx, phi, scratch, unsigned_distance);
+   for(unsigned int t=0; t<tri.size(); ++t){
+      rasterize_triangle(tri, x, t, origin, dx, phi, scratch.closest_tri, exact_band);
+      if(!unsigned_distance)
+         count_intersections(tri, x, t, origin, dx, ni, scratch.intersection_parity);
+   }
+   int rounds=sweep_level_set(tri, x, origin, dx, phi, scratch.closest_tri, max_iterations, &refine);
+   finish_level_set(phi, scratch.intersection_parity, unsigned_distance);
+   // and the far field comes from trilinear interpolation of the coarse field
+   parallel_for(0, nk, [&](int k){
+      int ck; float fk;
+      coarse_position(k, f, nck, ck, fk);
+      int ck1=min(ck+1, nck-1);
+      for(int j=0; j<nj; ++j){
+         int cj; float fj;
+         coarse_position(j, f, ncj, cj, fj);
+         int cj1=min(cj+1, ncj-1);
+         for(int i=0; i<ni; ++i){
+            if(refine(i/sweep_brick, j/sweep_brick, k/sweep_brick)) continue;
+            int ci; float fi;
+            coarse_position(i, f, nci, ci, fi);
+            int ci1=min(ci+1, nci-1);
+            phi(i,j,k)=trilerp(coarse(ci,cj,ck), coarse(ci1,cj,ck), coarse(ci,cj1,ck), coarse(ci1,cj1,ck),
+                               coarse(ci,cj,ck1), coarse(ci1,cj,ck1), coarse(ci,cj1,ck1), coarse(ci1,cj1,ck1),
+                               fi, fj, fk);
+         }
+      }
+   });
+   return rounds;
 }
 
+int update_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &old_x,
+                      const std::vector<Vec3f> &x, const std::vector<unsigned int> &changed_tri,
+                      const Vec3f &origin, float dx, Array3f &phi, LevelSetScratch &scratch,
+                      const int exact_band, const int max_iterations,
+                      const bool unsigned_distance)
+{
+   int ni=phi.ni, nj=phi.nj, nk=phi.nk;
+   // phi is only squared (to be swept) brick by brick where the edit reaches, and bricks
+   // start out as unchanged so sweeping spreads from the edit alone
+   int nbi=(ni+sweep_brick-1)/sweep_brick, nbj=(nj+sweep_brick-1)/sweep_brick, nbk=(nk+sweep_brick-1)/sweep_brick;
+   SweepUpdate update;
+   update.brick_changed.resize(nbi, nbj, nbk, -1);
+   update.squared_bricks.resize(nbi, nbj, nbk, (char)0);
+   update.moved_tri.assign(tri.size(), 0);
+   for(unsigned int c=0; c<changed_tri.size(); ++c) update.moved_tri[changed_tri[c]]=1;
+   Array3<char> &squared=update.squared_bricks;
+   Array3<int> &brick_changed=update.brick_changed;
+   // bricks with cells whose closest triangle moved are squared first, which gives those
+   // cells their distance to its new position; that is the one scan of the whole grid,
+   // and it only reads closest_tri
+   parallel_for(0, nbk, [&](int bk){
+      for(int k=bk*sweep_brick; k<min((bk+1)*sweep_brick, nk); ++k) for(int j=0; j<nj; ++j) for(int i=0; i<ni; ++i){
+         int t=scratch.closest_tri(i,j,k);
+         if(t<0 || !update.moved_tri[t]) continue;
+         int bi=i/sweep_brick, bj=j/sweep_brick;
+         if(!squared(bi,bj,bk)) square_brick(tri, x, phi, scratch.closest_tri, origin, dx, bi, bj, bk, squared);
+         brick_changed(bi,bj,bk)=0;
+      }
+   });
+   // then the moved triangles are rasterized again at their new positions, along with the
+   // unmoved triangles whose bands reach the bricks found above: a cell that lost its
+   // closest triangle may now be closest to one of those, which its neighbours need not know
+   update.lost_bricks=squared;
+   const Array3<char> &lost=update.lost_bricks;
+   for(unsigned int t=0; t<tri.size(); ++t){
+      double fi[3], fj[3], fk[3];
+      grid_coordinates(tri, x, t, origin, dx, fi, fj, fk);
+      int bi0=clamp(int(min(fi[0],fi[1],fi[2]))-exact_band, 0, ni-1)/sweep_brick, bi1=clamp(int(max(fi[0],fi[1],fi[2]))+exact_band+1, 0, ni-1)/sweep_brick;
+      int bj0=clamp(int(min(fj[0],fj[1],fj[2]))-exact_band, 0, nj-1)/sweep_brick, bj1=clamp(int(max(fj[0],fj[1],fj[2]))+exact_band+1, 0, nj-1)/sweep_brick;
+      int bk0=clamp(int(min(fk[0],fk[1],fk[2]))-exact_band, 0, nk-1)/sweep_brick, bk1=clamp(int(max(fk[0],fk[1],fk[2]))+exact_band+1, 0, nk-1)/sweep_brick;
+      bool reaches=update.moved_tri[t]!=0;
+      for(int bk=bk0; bk<=bk1 && !reaches; ++bk) for(int bj=bj0; bj<=bj1 && !reaches; ++bj) for(int bi=bi0; bi<=bi1 && !reaches; ++bi)
+         reaches=lost(bi,bj,bk)!=0;
+      if(!reaches) continue;
+      for(int bk=bk0; bk<=bk1; ++bk) for(int bj=bj0; bj<=bj1; ++bj) for(int bi=bi0; bi<=bi1; ++bi){
+         if(!squared(bi,bj,bk)) square_brick(tri, x, phi, scratch.closest_tri, origin, dx, bi, bj, bk, squared);
+         brick_changed(bi,bj,bk)=0;
+      }
+      rasterize_triangle(tri, x, t, origin, dx, phi, scratch.closest_tri, exact_band);
+   }
+   // parities are XORs, so counting a triangle's intersections again at its old position
+   // takes them out; the rows involved are the only ones outside the swept bricks whose
+   // signs can change
+   std::vector<char> row_changed;
+   if(!unsigned_distance){
+      row_changed.assign((size_t)nj*nk, 0);
+      for(unsigned int c=0; c<changed_tri.size(); ++c){
+         unsigned int t=changed_tri[c];
+         count_intersections(tri, old_x, t, origin, dx, ni, scratch.intersection_parity);
+         count_intersections(tri, x, t, origin, dx, ni, scratch.intersection_parity);
+         for(int pass=0; pass<2; ++pass){
+            double fi[3], fj[3], fk[3];
+            grid_coordinates(tri, pass ? x : old_x, t, origin, dx, fi, fj, fk);
+            int j0=clamp((int)std::ceil(min(fj[0],fj[1],fj[2])), 0, nj-1), j1=clamp((int)std::floor(max(fj[0],fj[1],fj[2])), 0, nj-1);
+            int k0=clamp((int)std::ceil(min(fk[0],fk[1],fk[2])), 0, nk-1), k1=clamp((int)std::floor(max(fk[0],fk[1],fk[2])), 0, nk-1);
+            for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j) row_changed[j+(size_t)nj*k]=1;
+         }
+      }
+   }
+   int rounds=sweep_level_set(tri, x, origin, dx, phi, scratch.closest_tri, max_iterations,
+                              0, &update);
+   // finally take square roots in the squared bricks, and redo the signs of every row
+   // that passes through one of them or had its parities changed
+   parallel_for(0, nk, [&](int k){
+      int bk=k/sweep_brick;
+      for(int j=0; j<nj; ++j){
+         int bj=j/sweep_brick;
+         bool any_squared=false;
+         for(int bi=0; bi<nbi && !any_squared; ++bi) any_squared=squared(bi,bj,bk)!=0;
+         if(unsigned_distance){
+            if(!any_squared) continue;
+            for(int bi=0; bi<nbi; ++bi){
+               if(!squared(bi,bj,bk)) continue;
+               for(int i=bi*sweep_brick; i<min((bi+1)*sweep_brick, ni); ++i) phi(i,j,k)=std::sqrt(phi(i,j,k));
+            }
+         }else{
+            if(!any_squared && !row_changed[j+(size_t)nj*k]) continue;
+            // squaring the rest of the row first is exact: sqrt(d*d)==|d| in floating point
+            for(int bi=0; bi<nbi; ++bi){
+               if(squared(bi,bj,bk)) continue;
+               for(int i=bi*sweep_brick; i<min((bi+1)*sweep_brick, ni); ++i) phi(i,j,k)=sqr(phi(i,j,k));
+            }
+            apply_row_signs(&phi(0,j,k), &phi(0,j,k), &scratch.intersection_parity(0,j,k), ni);
+         }
+      }
+   });
+   return rounds;
+}
@@ -4,13 +4,159 @@
 #include "array3.h"
 #include "vec.h"
 
+#include <memory>
+
 // tri is a list of triangles in the mesh, and x is the positions of the vertices
 // absolute distances will be nearly correct for triangle soup, but a closed mesh is
 // needed for accurate signs. Distances for all grid cells within exact_band cells of
 // a triangle should be exact; further away a distance is calculated but it might not
 // be to the closest triangle - just one nearby.
-void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
-                     const Vec3f &origin, float dx, int nx, int ny, int nz,
-                     Array3f &phi, const int exact_band=1);
+// The far field is filled in by at most max_iterations rounds of fast sweeping (eight
+// directions each); sweeping stops early once a full round of directions makes no
+// update. Returns the number of rounds actually used.
+// If unsigned_distance is true the inside/outside test is skipped entirely and phi
+// holds non-negative distances.
+// If truncation is positive, only distances up to it are computed: cells further from
+// the surface are left at +-truncation (with their signs still right), and sweeping is
+// restricted to the bricks within truncation of a triangle, so the cost follows the
+// size of the band rather than of the grid. Distances inside the band can differ
+// slightly from untruncated ones where sweeping reached them from outside the band.
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, int nx, int ny, int nz,
+                    Array3f &phi, const int exact_band=1, const int max_iterations=2,
+                    const bool unsigned_distance=false, const float truncation=0);
+
+// Sizing a grid to a box: the number of samples, spaced dx apart and starting padding
+// samples below the low end of an extent, needed to reach padding samples beyond its
+// high end as well (the small allowance keeps rounding from adding a sample)
+inline int padded_grid_samples(float extent, float dx, int padding)
+{
+   return (int)std::ceil(extent/dx-1e-4f)+1+2*padding;
+}
+
+// the spacing that makes padded_grid_samples give size samples along an extent; size
+// must exceed 2*padding+1
+inline float padded_grid_spacing(float extent, int size, int padding)
+{
+   return extent/(float)(size-1-2*padding);
+}
+
+// scratch grids used by make_level_set3; keeping one around between calls (e.g. when
+// processing many meshes) avoids reallocating them for every mesh
+struct LevelSetScratch
+{
+   Array3i closest_tri;
+   Array3ull intersection_parity;
+};
+
+// same as above, but with the scratch grids supplied by the caller
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, int nx, int ny, int nz,
+                    Array3f &phi, LevelSetScratch &scratch, const int exact_band=1,
+                    const int max_iterations=2, const bool unsigned_distance=false,
+                    const float truncation=0);
+
+// The types make_level_set3 can write its result in directly, which saves converting
+// (and holding) a float grid afterwards. Each distance is clamped to
+// [-truncation, truncation] (unless truncation is 0) and multiplied by scale; the integer
+// types round to nearest and saturate at +-(2^(bits-1)-1).
+enum LevelSetDtype { level_set_float32, level_set_float16, level_set_int16, level_set_int8 };
+
+struct LevelSetOutput
+{
+   LevelSetDtype dtype;
+   float truncation, scale;
+   void *data; // ni*nj*nk samples in Array3 order (i fastest, then j, then k)
+
+   LevelSetOutput(LevelSetDtype dtype_, float truncation_, float scale_, void *data_)
+      : dtype(dtype_), truncation(truncation_), scale(scale_), data(data_) {}
+};
+
+// make_level_set3 with the result written to out as the signs are applied, instead of
+// to phi; phi is only working storage here and is left holding squared distances
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, int nx, int ny, int nz,
+                    const LevelSetOutput &out, Array3f &phi, LevelSetScratch &scratch,
+                    const int exact_band=1, const int max_iterations=2,
+                    const bool unsigned_distance=false, const float truncation=0);
+
+// write the n finished distances phi (in Array3 order) to out, for results that come
+// from elsewhere (a region of interest, the multiresolution path, a cache)
+void convert_level_set3(const float *phi, size_t n, const LevelSetOutput &out);
+
+// Compute only the region of interest [roi_min, roi_max) (in cell indices, max exclusive)
+// of the grid with the given origin and dx; phi is resized to the ROI's dimensions and
+// phi(0,0,0) is the cell at roi_min. Triangles that cannot be the closest to any cell of
+// the ROI are culled and sweeping is done inside the ROI only, while signs still count
+// every intersection from the -x edge, so they agree with the full grid. A lattice of
+// cells on the ROI's faces gets exact distances to bring in triangles outside the ROI;
+// as for the full grid, cells beyond exact_band might not get the closest triangle.
+// An ROI (or grid) one cell thick along an axis, such as a slice, is swept in its plane.
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, const Vec3i &roi_min, const Vec3i &roi_max,
+                    Array3f &phi, const int exact_band=1, const int max_iterations=2,
+                    const bool unsigned_distance=false);
+
+int make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                    const Vec3f &origin, float dx, const Vec3i &roi_min, const Vec3i &roi_max,
+                    Array3f &phi, LevelSetScratch &scratch, const int exact_band=1,
+                    const int max_iterations=2, const bool unsigned_distance=false);
+
+struct TriangleBins;
+
+// The preprocessing of a mesh that doesn't depend on the grid: the mesh itself, the
+// bounding box of each triangle (min and max corners of triangle t at 2t and 2t+1) and
+// of the whole mesh, and the triangles binned on a coarse grid, which regions of interest
+// use to find the triangles near them or crossing their rows and the closest triangles to
+// the cells seeded on their faces. Building it once lets grids of several resolutions,
+// bounds or regions of interest of the same mesh share it, together with one
+// LevelSetScratch. It doesn't serve update_level_set3, whose vertices move.
+struct LevelSetMesh
+{
+   std::vector<Vec3ui> tri;
+   std::vector<Vec3f> x;
+   std::vector<Vec3f> tri_box;
+   Vec3f bbox_min, bbox_max; // of all the vertices; zero if there are none
+   std::shared_ptr<const TriangleBins> bins;
+
+   LevelSetMesh(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x);
+};
+
+// make_level_set3 for a preprocessed mesh, on the full grid or a region of interest
+int make_level_set3(const LevelSetMesh &mesh, const Vec3f &origin, float dx, int nx, int ny, int nz,
+                    Array3f &phi, LevelSetScratch &scratch, const int exact_band=1,
+                    const int max_iterations=2, const bool unsigned_distance=false,
+                    const float truncation=0);
+
+int make_level_set3(const LevelSetMesh &mesh, const Vec3f &origin, float dx,
+                    const Vec3i &roi_min, const Vec3i &roi_max, Array3f &phi,
+                    LevelSetScratch &scratch, const int exact_band=1,
+                    const int max_iterations=2, const bool unsigned_distance=false);
+
+// Update phi, computed by make_level_set3 with the same grid, scratch and options, after
+// the triangles in changed_tri moved from their positions in old_x to those in x (the
+// triangles themselves are the same). Only cells whose closest triangle moved, the bands
+// of the moved triangles and of the triangles near those cells, and what sweeping reaches
+// from there are recomputed, along with the signs of the rows the moved triangles cross,
+// so the cost follows the size of the edit rather than of the grid (apart from one pass
+// reading scratch.closest_tri). Cells within exact_band of the surface come out as in a
+// full recomputation; the far field may differ slightly, since it depends on the order in
+// which cells are swept. Returns the number of rounds used.
+int update_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &old_x,
+                      const std::vector<Vec3f> &x, const std::vector<unsigned int> &changed_tri,
+                      const Vec3f &origin, float dx, Array3f &phi, LevelSetScratch &scratch,
+                      const int exact_band=1, const int max_iterations=2,
+                      const bool unsigned_distance=false);
+
+// Coarse-to-fine computation of the same grid as make_level_set3: the field is first
+// computed with cells coarsening times larger, and only the sweep bricks that the coarse
+// field puts within refine_band (fine) cells of the surface are swept at the fine
+// resolution. Everywhere else phi is interpolated trilinearly from the coarse field, so
+// near-surface values match make_level_set3 while far-field values are approximate.
+int make_level_set3_multires(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                             const Vec3f &origin, float dx, int nx, int ny, int nz,
+                             Array3f &phi, const int coarsening=4, const int refine_band=4,
+                             const int exact_band=1, const int max_iterations=2,
+                             const bool unsigned_distance=false);
 
 #endif
@@ -0,0 +1,728 @@
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+#include "vec.h"
+
+// Mesh file loaders for OBJ, binary PLY and binary STL. Files are mapped rather than
+// read, and parsed in parallel on the shared scheduler: OBJ text in parts split at line
+// boundaries, with numbers parsed by std::from_chars so the text never goes through
+// streams or temporary strings, and binary records directly from the mapping.
+
+// what a loader did
+struct MeshLoadStats {
+   uint64_t bytes;
+   uint64_t polygons;     // faces read, before triangulation
+   uint64_t welded;       // STL corners merged into a vertex seen before
+   double seconds;
+
+   MeshLoadStats() : bytes(0), polygons(0), welded(0), seconds(0) {}
+
+   double mb_per_second() const { return seconds > 0 ? bytes / seconds * 1e-6 : 0; }
+};
+
+namespace mesh_detail {
+   // a read-only mapping of a whole file
+   struct MappedFile {
+      const char* data;
+      size_t size;
+
+      MappedFile() : data(0), size(0), fd(-1) {}
+      ~MappedFile() {
+         if (data && size) munmap((void*)data, size);
+         if (fd >= 0) close(fd);
+      }
+
+      bool open(const std::string& path) {
+         fd = ::open(path.c_str(), O_RDONLY);
+         struct stat st;
+         if (fd < 0 || fstat(fd, &st) != 0) return false;
+         size = (size_t)st.st_size;
+         if (size == 0) {
+            data = "";
+            return true;
+         }
+         void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (p == MAP_FAILED) return false;
+         madvise(p, size, MADV_SEQUENTIAL);
+         data = (const char*)p;
+         return true;
+      }
+
+   private:
+      int fd;
+
+      MappedFile(const MappedFile&);
+      MappedFile& operator=(const MappedFile&);
+   };
+
+   inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+   inline const char* skip_blanks(const char* p, const char* end) {
+      while (p != end && is_blank(*p)) ++p;
+      return p;
+   }
+
+   inline const char* skip_token(const char* p, const char* end) {
+      while (p != end && !is_blank(*p) && *p != '\n') ++p;
+      return p;
+   }
+
+   inline const char* next_line(const char* p, const char* end) {
+      while (p != end && *p != '\n') ++p;
+      return p == end ? end : p + 1;
+   }
+
+   template<class T>
+   inline bool parse_number(const char*& p, const char* end, T& value) {
+      p = skip_blanks(p, end);
+      if (p != end && *p == '+') ++p; // from_chars takes no plus sign
+      std::from_chars_result r = std::from_chars(p, end, value);
+      if (r.ec != std::errc()) return false;
+      p = r.ptr;
+      return true;
+   }
+
+   // what one part of an OBJ file holds. Faces are fanned into triangles whose corners
+   // are vertex indices; a negative (relative) OBJ index can only be resolved once the
+   // number of vertices in the parts before is known, so such corners are stored
+   // relative to this part's first vertex and listed in `relative`.
+   struct ObjPart {
+      const char* begin;
+      const char* end;
+      std::vector<Vec3f> x;
+      std::vector<int64_t> corners;
+      std::vector<size_t> relative;
+      uint64_t polygons;
+      const char* error; // where parsing failed, or null
+
+      ObjPart() : begin(0), end(0), polygons(0), error(0) {}
+   };
+
+   inline void parse_obj_part(ObjPart& part) {
+      std::vector<int64_t> polygon;
+      std::vector<char> polygon_relative;
+      const char* end = part.end;
+      for (const char* p = part.begin; p != end; p = next_line(p, end)) {
+         p = skip_blanks(p, end);
+         if (end - p < 2 || !is_blank(p[1])) continue;
+         if (p[0] == 'v') {
+            ++p;
+            Vec3f v;
+            if (!parse_number(p, end, v[0]) || !parse_number(p, end, v[1]) ||
+                !parse_number(p, end, v[2])) {
+               part.error = p;
+               return;
+            }
+            part.x.push_back(v);
+         } else if (p[0] == 'f') {
+            // corners are v, v/vt, v//vn or v/vt/vn; only v matters here
+            ++p;
+            polygon.clear();
+            polygon_relative.clear();
+            for (p = skip_blanks(p, end); p != end && *p != '\n'; p = skip_blanks(p, end)) {
+               int64_t index;
+               if (!parse_number(p, end, index) || index == 0) {
+                  part.error = p;
+                  return;
+               }
+               polygon.push_back(index > 0 ? index - 1 : (int64_t)part.x.size() + index);
+               polygon_relative.push_back(index < 0);
+               p = skip_token(p, end);
+            }
+            if (polygon.size() < 3) {
+               part.error = p;
+               return;
+            }
+            for (size_t c = 1; c + 1 < polygon.size(); ++c) {
+               const size_t corner[3] = {0, c, c + 1};
+               for (int n = 0; n < 3; ++n) {
+                  if (polygon_relative[corner[n]]) part.relative.push_back(part.corners.size());
+                  part.corners.push_back(polygon[corner[n]]);
+               }
+            }
+            ++part.polygons;
+         }
+      }
+   }
+}
+
+// Load a Wavefront OBJ file: the positions of its vertices ("v" lines; texture
+// coordinates, normals and everything else are skipped) and its faces, with polygons
+// fanned into triangles. Indices may be positive or relative, with or without /vt and
+// /vn parts. Returns false with a message in error if the file can't be read or is
+// malformed.
+inline bool load_obj(const std::string& path, std::vector<Vec3f>& x, std::vector<Vec3ui>& tri,
+                     std::string* error = 0, MeshLoadStats* stats = 0) {
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   x.clear();
+   tri.clear();
+   mesh_detail::MappedFile file;
+   if (!file.open(path)) {
+      if (error) *error = "cannot open " + path;
+      return false;
+   }
+
+   // split at line boundaries into a few parts per thread, so that uneven lines even out
+   const size_t min_part = 1 << 20;
+   int n_parts = (int)std::min<size_t>(4 * (TaskScheduler::instance().size() + 1),
+                                      file.size / min_part + 1);
+   const char* end = file.data + file.size;
+   std::vector<mesh_detail::ObjPart> parts(n_parts);
+   for (int n = 0; n < n_parts; ++n) {
+      const char* p = n == 0 ? file.data : file.data + file.size / n_parts * n;
+      parts[n].begin = n == 0 ? p : mesh_detail::next_line(p - 1, end);
+   }
+   for (int n = 0; n < n_parts; ++n) {
+      parts[n].end = n + 1 < n_parts ? parts[n + 1].begin : end;
+      if (parts[n].end < parts[n].begin) parts[n].end = parts[n].begin;
+   }
+   parallel_for(0, n_parts, [&](int n) { mesh_detail::parse_obj_part(parts[n]); });
+
+   // then number the vertices and triangles of each part after those of the parts before
+   std::vector<size_t> first_vertex(n_parts + 1, 0), first_tri(n_parts + 1, 0);
+   uint64_t polygons = 0;
+   for (int n = 0; n < n_parts; ++n) {
+      if (parts[n].error) {
+         size_t line = 1 + std::count(file.data, parts[n].error, '\n');
+         if (error) *error = path + ":" + std::to_string(line) + ": malformed vertex or face";
+         return false;
+      }
+      first_vertex[n + 1] = first_vertex[n] + parts[n].x.size();
+      first_tri[n + 1] = first_tri[n] + parts[n].corners.size() / 3;
+      polygons += parts[n].polygons;
+   }
+   const int64_t n_vertices = (int64_t)first_vertex[n_parts];
+   x.resize(n_vertices);
+   tri.resize(first_tri[n_parts]);
+   std::vector<char> out_of_range(n_parts, 0);
+   parallel_for(0, n_parts, [&](int n) {
+      mesh_detail::ObjPart& part = parts[n];
+      std::copy(part.x.begin(), part.x.end(), x.begin() + first_vertex[n]);
+      for (size_t r = 0; r < part.relative.size(); ++r)
+         part.corners[part.relative[r]] += (int64_t)first_vertex[n];
+      for (size_t c = 0; c < part.corners.size(); ++c)
+         if (part.corners[c] < 0 || part.corners[c] >= n_vertices) out_of_range[n] = 1;
+      for (size_t t = 0; t < part.corners.size() / 3; ++t)
+         tri[first_tri[n] + t] = Vec3ui((unsigned int)part.corners[3 * t], (unsigned int)part.corners[3 * t + 1],
+                                        (unsigned int)part.corners[3 * t + 2]);
+      std::vector<Vec3f>().swap(part.x);
+      std::vector<int64_t>().swap(part.corners);
+   });
+   for (int n = 0; n < n_parts; ++n) {
+      if (out_of_range[n]) {
+         if (error) *error = path + ": a face refers to a vertex that doesn't exist";
+         x.clear();
+         tri.clear();
+         return false;
+      }
+   }
+   if (stats) {
+      stats->bytes = file.size;
+      stats->polygons = polygons;
+      stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+   return true;
+}
+
+namespace mesh_detail {
+   inline void finish_stats(MeshLoadStats* stats, uint64_t bytes, uint64_t polygons, uint64_t welded,
+                            std::chrono::steady_clock::time_point start) {
+      if (!stats) return;
+      stats->bytes = bytes;
+      stats->polygons = polygons;
+      stats->welded = welded;
+      stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+
+   inline bool fail(std::string* error, const std::string& message) {
+      if (error) *error = message;
+      return false;
+   }
+
+   // PLY scalar types, by their size in bytes and how to read them
+   enum PlyType { ply_int8, ply_uint8, ply_int16, ply_uint16, ply_int32, ply_uint32, ply_float32,
+                  ply_float64, ply_invalid };
+
+   inline PlyType ply_type(const std::string& name) {
+      static const char* names[][2] = {{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"},
+                                       {"ushort", "uint16"}, {"int", "int32"}, {"uint", "uint32"},
+                                       {"float", "float32"}, {"double", "float64"}};
+      for (int t = 0; t < ply_invalid; ++t)
+         if (name == names[t][0] || name == names[t][1]) return (PlyType)t;
+      return ply_invalid;
+   }
+
+   inline int ply_size(PlyType type) {
+      static const int sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+      return sizes[type];
+   }
+
+   template<class T>
+   inline T load(const char* p, bool swap) {
+      unsigned char b[sizeof(T)];
+      std::memcpy(b, p, sizeof(T));
+      if (swap) std::reverse(b, b + sizeof(T));
+      T v;
+      std::memcpy(&v, b, sizeof(T));
+      return v;
+   }
+
+   inline double ply_value(const char* p, PlyType type, bool swap) {
+      switch (type) {
+         case ply_int8: return (double)(signed char)*p;
+         case ply_uint8: return (double)(unsigned char)*p;
+         case ply_int16: return load<int16_t>(p, swap);
+         case ply_uint16: return load<uint16_t>(p, swap);
+         case ply_int32: return load<int32_t>(p, swap);
+         case ply_uint32: return load<uint32_t>(p, swap);
+         case ply_float32: return load<float>(p, swap);
+         default: return load<double>(p, swap);
+      }
+   }
+
+   // a list count or vertex index, read as a signed value: -1 if it is negative (or
+   // beyond 32 bits, or not a number) for the caller to reject, else the value
+   inline int64_t ply_index(const char* p, PlyType type, bool swap) {
+      double v = ply_value(p, type, swap);
+      return v >= 0 && v < 4294967296.0 ? (int64_t)v : -1;
+   }
+
+   struct PlyProperty {
+      std::string name;
+      PlyType type;        // of the value, or of the items of a list
+      PlyType count_type;  // ply_invalid unless a list
+   };
+
+   struct PlyElement {
+      std::string name;
+      uint64_t count;
+      std::vector<PlyProperty> properties;
+      int fixed_size;      // bytes per record, or -1 if it has lists
+   };
+
+   // the bytes of the record at p, or 0 if it runs past end (or a list count is negative)
+   inline size_t ply_record_size(const PlyElement& e, const char* p, const char* end, bool swap) {
+      if (e.fixed_size >= 0) return end - p >= e.fixed_size ? e.fixed_size : 0;
+      const char* q = p;
+      for (size_t n = 0; n < e.properties.size(); ++n) {
+         const PlyProperty& prop = e.properties[n];
+         if (prop.count_type == ply_invalid) {
+            q += ply_size(prop.type);
+         } else {
+            if (end - q < ply_size(prop.count_type)) return 0;
+            int64_t count = ply_index(q, prop.count_type, swap);
+            if (count < 0) return 0;
+            q += ply_size(prop.count_type) + (size_t)count * ply_size(prop.type);
+         }
+         if (q > end) return 0;
+      }
+      return q - p;
+   }
+
+   // parse a PLY header; body is set to the first byte after it
+   inline bool parse_ply_header(const char* data, size_t size, std::vector<PlyElement>& elements,
+                                bool& swap, const char*& body, std::string& message) {
+      const char* end = data + size;
+      const char* header_end = 0;
+      for (const char* p = data; p != end; p = next_line(p, end)) {
+         if (end - p >= 10 && std::memcmp(p, "end_header", 10) == 0) {
+            header_end = p;
+            break;
+         }
+      }
+      if (size < 4 || std::memcmp(data, "ply", 3) != 0 || !header_end) {
+         message = "not a PLY file";
+         return false;
+      }
+      body = next_line(header_end, end);
+      std::istringstream header(std::string(data, header_end));
+      std::string line;
+      bool have_format = false;
+      while (std::getline(header, line)) {
+         std::istringstream words(line);
+         std::string keyword;
+         words >> keyword;
+         if (keyword == "format") {
+            std::string format;
+            words >> format;
+            if (format == "ascii") {
+               message = "ASCII PLY files are not supported, only binary ones";
+               return false;
+            }
+            if (format != "binary_little_endian" && format != "binary_big_endian") {
+               message = "unknown PLY format " + format;
+               return false;
+            }
+            uint32_t one = 1;
+            bool little_endian_host = *(const unsigned char*)&one == 1;
+            swap = (format == "binary_little_endian") != little_endian_host;
+            have_format = true;
+         } else if (keyword == "element") {
+            PlyElement e;
+            words >> e.name >> e.count;
+            e.fixed_size = 0;
+            elements.push_back(e);
+         } else if (keyword == "property") {
+            if (elements.empty()) {
+               message = "PLY property outside of an element";
+               return false;
+            }
+            PlyProperty prop;
+            std::string type;
+            words >> type;
+            prop.count_type = ply_invalid;
+            if (type == "list") {
+               std::string count_type;
+               words >> count_type >> type;
+               prop.count_type = ply_type(count_type);
+               if (prop.count_type == ply_invalid || prop.count_type == ply_float32 ||
+                   prop.count_type == ply_float64) {
+                  message = "bad PLY list count type " + count_type;
+                  return false;
+               }
+            }
+            prop.type = ply_type(type);
+            words >> prop.name;
+            if (prop.type == ply_invalid) {
+               message = "unknown PLY type " + type;
+               return false;
+            }
+            PlyElement& e = elements.back();
+            if (prop.count_type != ply_invalid) e.fixed_size = -1;
+            else if (e.fixed_size >= 0) e.fixed_size += ply_size(prop.type);
+            e.properties.push_back(prop);
+         }
+      }
+      if (!have_format) {
+         message = "PLY header has no format";
+         return false;
+      }
+      return true;
+   }
+}
+
+// Load a binary (little or big endian) PLY file: the x, y and z properties of its
+// "vertex" element and the vertex_indices (or vertex_index) lists of its "face" element,
+// with polygons fanned into triangles. Other elements and properties are skipped. Packed
+// float x, y, z vertices are copied from the mapping in one go, and faces that are all
+// triangles are converted in parallel.
+inline bool load_ply(const std::string& path, std::vector<Vec3f>& x, std::vector<Vec3ui>& tri,
+                     std::string* error = 0, MeshLoadStats* stats = 0) {
+   using namespace mesh_detail;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   x.clear();
+   tri.clear();
+   MappedFile file;
+   if (!file.open(path)) return fail(error, "cannot open " + path);
+   std::vector<PlyElement> elements;
+   bool swap = false;
+   const char* p;
+   std::string message;
+   if (!parse_ply_header(file.data, file.size, elements, swap, p, message))
+      return fail(error, path + ": " + message);
+   const char* end = file.data + file.size;
+   const std::string truncated = path + ": the file ends early";
+   const std::string bad_index = path + ": a face refers to a vertex that doesn't exist";
+   uint64_t polygons = 0;
+   bool have_vertices = false;
+
+   for (size_t n = 0; n < elements.size(); ++n) {
+      const PlyElement& e = elements[n];
+      if (e.name == "vertex") {
+         // x, y and z must be plain values in fixed-size records
+         int offset[3] = {-1, -1, -1}, at = 0;
+         PlyType type[3] = {ply_invalid, ply_invalid, ply_invalid};
+         for (size_t q = 0; q < e.properties.size(); ++q) {
+            const PlyProperty& prop = e.properties[q];
+            for (int a = 0; a < 3; ++a) {
+               if (prop.name == std::string(1, (char)('x' + a)) && prop.count_type == ply_invalid) {
+                  offset[a] = at;
+                  type[a] = prop.type;
+               }
+            }
+            at += ply_size(prop.type);
+         }
+         if (e.fixed_size < 0 || offset[0] < 0 || offset[1] < 0 || offset[2] < 0)
+            return fail(error, path + ": PLY vertices need fixed-size records with x, y and z");
+         if ((uint64_t)(end - p) / e.fixed_size < e.count) return fail(error, truncated);
+         x.resize(e.count);
+         const char* base = p;
+         const size_t stride = e.fixed_size;
+         bool packed = !swap && stride == 12 && offset[0] == 0 && offset[1] == 4 && offset[2] == 8 &&
+                       type[0] == ply_float32 && type[1] == ply_float32 && type[2] == ply_float32;
+         if (packed && !x.empty()) {
+            std::memcpy(&x[0], base, e.count * sizeof(Vec3f));
+         } else {
+            const int block = 1 << 16;
+            parallel_for(0, (int)((e.count + block - 1) / block), [&](int b) {
+               for (size_t v = (size_t)b * block; v < std::min<size_t>(e.count, (size_t)(b + 1) * block); ++v)
+                  for (int a = 0; a < 3; ++a)
+                     x[v][a] = (float)ply_value(base + v * stride + offset[a], type[a], swap);
+            });
+         }
+         p += e.count * stride;
+         have_vertices = true;
+      } else if (e.name == "face") {
+         int list = -1, before = 0;
+         for (size_t q = 0; q < e.properties.size(); ++q) {
+            const PlyProperty& prop = e.properties[q];
+            if ((prop.name == "vertex_indices" || prop.name == "vertex_index") && prop.count_type != ply_invalid) {
+               list = (int)q;
+               break;
+            }
+            before += prop.count_type == ply_invalid ? ply_size(prop.type) : 0;
+         }
+         if (list < 0) return fail(error, path + ": PLY faces have no vertex_indices list");
+         if (!have_vertices) return fail(error, path + ": PLY faces come before the vertices");
+         const PlyProperty& indices = e.properties[list];
+         const int count_size = ply_size(indices.count_type), index_size = ply_size(indices.type);
+         // if the list is the only one, and every face is a triangle, the records have a
+         // fixed size and can be converted in parallel; check that first
+         bool one_list = true;
+         int after = 0;
+         for (size_t q = 0; q < e.properties.size(); ++q) {
+            if ((int)q == list) continue;
+            if (e.properties[q].count_type != ply_invalid) one_list = false;
+            else if ((int)q > list) after += ply_size(e.properties[q].type);
+         }
+         const size_t stride = before + count_size + 3 * index_size + after;
+         bool triangles = one_list && (uint64_t)(end - p) / stride >= e.count;
+         const int block = 1 << 16;
+         const int n_blocks = (int)((e.count + block - 1) / block);
+         const char* base = p;
+         if (triangles) {
+            std::vector<char> all_three(n_blocks, 1);
+            parallel_for(0, n_blocks, [&](int b) {
+               for (size_t f = (size_t)b * block; f < std::min<size_t>(e.count, (size_t)(b + 1) * block); ++f)
+                  if (ply_value(base + f * stride + before, indices.count_type, swap) != 3) {
+                     all_three[b] = 0;
+                     break;
+                  }
+            });
+            triangles = std::count(all_three.begin(), all_three.end(), 0) == 0;
+         }
+         if (triangles) {
+            tri.resize(e.count);
+            std::vector<char> valid(n_blocks, 1);
+            parallel_for(0, n_blocks, [&](int b) {
+               for (size_t f = (size_t)b * block; f < std::min<size_t>(e.count, (size_t)(b + 1) * block); ++f) {
+                  const char* q = base + f * stride + before + count_size;
+                  for (int c = 0; c < 3; ++c) {
+                     int64_t index = ply_index(q + c * index_size, indices.type, swap);
+                     if (index < 0) valid[b] = 0;
+                     tri[f][c] = (unsigned int)index;
+                  }
+               }
+            });
+            if (std::count(valid.begin(), valid.end(), 0) != 0) {
+               x.clear();
+               tri.clear();
+               return fail(error, bad_index);
+            }
+            p += e.count * stride;
+         } else {
+            std::vector<unsigned int> polygon;
+            for (uint64_t f = 0; f < e.count; ++f) {
+               size_t bytes = ply_record_size(e, p, end, swap);
+               if (bytes == 0) return fail(error, truncated);
+               const char* q = p;
+               for (int r = 0; r < list; ++r) {
+                  const PlyProperty& prop = e.properties[r];
+                  q += prop.count_type == ply_invalid ? ply_size(prop.type)
+                     : ply_size(prop.count_type) + (size_t)ply_index(q, prop.count_type, swap) * ply_size(prop.type);
+               }
+               // ply_record_size has checked that the counts aren't negative
+               size_t count = (size_t)ply_index(q, indices.count_type, swap);
+               q += count_size;
+               polygon.resize(count);
+               for (size_t c = 0; c < count; ++c) {
+                  int64_t index = ply_index(q + c * index_size, indices.type, swap);
+                  if (index < 0) {
+                     x.clear();
+                     tri.clear();
+                     return fail(error, bad_index);
+                  }
+                  polygon[c] = (unsigned int)index;
+               }
+               for (size_t c = 1; c + 1 < count; ++c) tri.push_back(Vec3ui(polygon[0], polygon[c], polygon[c + 1]));
+               p += bytes;
+            }
+         }
+         polygons += e.count;
+      } else {
+         // anything else is skipped
+         if (e.fixed_size >= 0) {
+            if ((uint64_t)(end - p) / std::max(e.fixed_size, 1) < e.count) return fail(error, truncated);
+            p += e.count * e.fixed_size;
+         } else {
+            for (uint64_t r = 0; r < e.count; ++r) {
+               size_t bytes = ply_record_size(e, p, end, swap);
+               if (bytes == 0) return fail(error, truncated);
+               p += bytes;
+            }
+         }
+      }
+   }
+   for (size_t t = 0; t < tri.size(); ++t) {
+      if (tri[t][0] >= x.size() || tri[t][1] >= x.size() || tri[t][2] >= x.size()) {
+         x.clear();
+         tri.clear();
+         return fail(error, bad_index);
+      }
+   }
+   finish_stats(stats, file.size, polygons, 0, start);
+   return true;
+}
+
+namespace mesh_detail {
+   // the bits of a position, with -0 taken as +0 so the two weld together
+   inline void position_bits(const char* p, uint32_t bits[3]) {
+      for (int a = 0; a < 3; ++a) {
+         float v = load<float>(p + 4 * a, false) + 0.0f;
+         std::memcpy(&bits[a], &v, 4);
+      }
+   }
+
+   inline uint64_t position_hash(const uint32_t bits[3]) {
+      uint64_t h = bits[0] * 0x9e3779b97f4a7c15ull;
+      h = (h ^ (h >> 29) ^ bits[1]) * 0xbf58476d1ce4e5b9ull;
+      h = (h ^ (h >> 32) ^ bits[2]) * 0x94d049bb133111ebull;
+      return h ^ (h >> 31);
+   }
+}
+
+// Load a binary STL file. STL stores every triangle with its own copies of its corners,
+// so corners at the same position are welded into one vertex: they are hashed, split
+// into partitions by hash, and each partition is welded with its own hash table in
+// parallel. Vertices are numbered by partition, in the order they first appear in each.
+inline bool load_stl(const std::string& path, std::vector<Vec3f>& x, std::vector<Vec3ui>& tri,
+                     std::string* error = 0, MeshLoadStats* stats = 0) {
+   using namespace mesh_detail;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   x.clear();
+   tri.clear();
+   MappedFile file;
+   if (!file.open(path)) return fail(error, "cannot open " + path);
+   if (file.size < 84) return fail(error, path + ": not a binary STL file");
+   const uint64_t n_tri = load<uint32_t>(file.data + 80, false);
+   if (file.size != 84 + 50 * n_tri) {
+      if (std::memcmp(file.data, "solid", 5) == 0)
+         return fail(error, path + ": ASCII STL files are not supported, only binary ones");
+      return fail(error, path + ": the size of the STL file doesn't match its triangle count");
+   }
+   // the position of corner c is at corner(c)
+   const char* records = file.data + 84;
+   auto corner = [&](size_t c) { return records + (c / 3) * 50 + 12 + (c % 3) * 12; };
+   const size_t n_corners = 3 * n_tri;
+
+   const int partition_bits = 6, n_partitions = 1 << partition_bits;
+   const int block = 1 << 16;
+   const int n_blocks = (int)((n_corners + block - 1) / block);
+   std::vector<uint64_t> hash(n_corners);
+   // counts[b*n_partitions + p] is the number of corners of block b in partition p
+   std::vector<size_t> counts((size_t)n_blocks * n_partitions, 0);
+   parallel_for(0, n_blocks, [&](int b) {
+      for (size_t c = (size_t)b * block; c < std::min(n_corners, (size_t)(b + 1) * block); ++c) {
+         uint32_t bits[3];
+         position_bits(corner(c), bits);
+         hash[c] = position_hash(bits);
+         ++counts[(size_t)b * n_partitions + (hash[c] >> (64 - partition_bits))];
+      }
+   });
+   // lay the partitions out one after another, each in corner order
+   std::vector<size_t> partition_start(n_partitions + 1, 0);
+   std::vector<size_t> slot((size_t)n_blocks * n_partitions);
+   size_t at = 0;
+   for (int q = 0; q < n_partitions; ++q) {
+      partition_start[q] = at;
+      for (int b = 0; b < n_blocks; ++b) {
+         slot[(size_t)b * n_partitions + q] = at;
+         at += counts[(size_t)b * n_partitions + q];
+      }
+      partition_start[q + 1] = at;
+   }
+   std::vector<uint32_t> order(n_corners);
+   parallel_for(0, n_blocks, [&](int b) {
+      size_t* next = &slot[(size_t)b * n_partitions];
+      for (size_t c = (size_t)b * block; c < std::min(n_corners, (size_t)(b + 1) * block); ++c)
+         order[next[hash[c] >> (64 - partition_bits)]++] = (uint32_t)c;
+   });
+
+   // weld each partition: vertex_of[c] is the partition's number for corner c's vertex,
+   // and first[p] lists the corners that were the first at their position
+   std::vector<uint32_t> vertex_of(n_corners);
+   std::vector<std::vector<uint32_t> > first(n_partitions);
+   parallel_for(0, n_partitions, [&](int q) {
+      size_t n = partition_start[q + 1] - partition_start[q];
+      size_t capacity = 16;
+      while (capacity < 2 * n) capacity *= 2;
+      std::vector<uint32_t> table(capacity, UINT32_MAX); // first corner at the position, by local vertex
+      std::vector<uint32_t>& firsts = first[q];
+      for (size_t k = partition_start[q]; k < partition_start[q + 1]; ++k) {
+         uint32_t c = order[k];
+         uint32_t bits[3];
+         position_bits(corner(c), bits);
+         for (size_t h = hash[c] & (capacity - 1);; h = (h + 1) & (capacity - 1)) {
+            if (table[h] == UINT32_MAX) {
+               table[h] = (uint32_t)firsts.size();
+               vertex_of[c] = (uint32_t)firsts.size();
+               firsts.push_back(c);
+               break;
+            }
+            uint32_t other = firsts[table[h]], other_bits[3];
+            if (hash[other] != hash[c]) continue;
+            position_bits(corner(other), other_bits);
+            if (std::memcmp(bits, other_bits, sizeof(bits)) == 0) {
+               vertex_of[c] = table[h];
+               break;
+            }
+         }
+      }
+   });
+   std::vector<size_t> first_vertex(n_partitions + 1, 0);
+   for (int q = 0; q < n_partitions; ++q) first_vertex[q + 1] = first_vertex[q] + first[q].size();
+   x.resize(first_vertex[n_partitions]);
+   parallel_for(0, n_partitions, [&](int q) {
+      for (size_t v = 0; v < first[q].size(); ++v) {
+         uint32_t bits[3];
+         position_bits(corner(first[q][v]), bits);
+         std::memcpy(&x[first_vertex[q] + v], bits, sizeof(bits));
+      }
+   });
+   tri.resize(n_tri);
+   parallel_for(0, n_blocks, [&](int b) {
+      for (size_t c = (size_t)b * block; c < std::min(n_corners, (size_t)(b + 1) * block); ++c)
+         tri[c / 3][c % 3] = (unsigned int)(first_vertex[hash[c] >> (64 - partition_bits)] + vertex_of[c]);
+   });
+   finish_stats(stats, file.size, n_tri, n_corners - x.size(), start);
+   return true;
+}
+
+// Load a mesh by the extension of path: .obj, .ply or .stl (in any case)
+inline bool load_mesh(const std::string& path, std::vector<Vec3f>& x, std::vector<Vec3ui>& tri,
+                      std::string* error = 0, MeshLoadStats* stats = 0) {
+   size_t dot = path.rfind('.');
+   std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+   for (size_t c = 0; c < ext.size(); ++c) ext[c] = (char)std::tolower((unsigned char)ext[c]);
+   if (ext == "obj") return load_obj(path, x, tri, error, stats);
+   if (ext == "ply") return load_ply(path, x, tri, error, stats);
+   if (ext == "stl") return load_stl(path, x, tri, error, stats);
+   return mesh_detail::fail(error, path + ": unknown mesh format (expected .obj, .ply or .stl)");
+}
+
+#endif // MESH_FILE_H
@@ -0,0 +1,264 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// A persistent work-stealing scheduler shared by everything in the process, so that
+// batch jobs and the parallel loops inside each job draw from the same threads rather
+// than each starting their own. Every worker has its own deque: tasks submitted from a
+// worker go to the back of its deque and it runs them newest first, while idle workers
+// steal the oldest tasks from the others. Tasks submitted from outside the pool are
+// dealt out over the workers round-robin. There is no waiting on a submitted task, so
+// nothing could receive its exception: tasks passed to submit must not throw, and must
+// report failures through their own results (parallel_for catches and rethrows on the
+// calling thread; compute_batch stores an exception_ptr per job). One that escapes
+// anyway is dropped rather than ending the process, and counted in Stats::failed_tasks.
+class TaskScheduler
+{
+public:
+   struct Stats
+   {
+      long tasks;          // tasks run
+      long steals;         // tasks taken from another worker's deque
+      double idle_seconds; // total time workers spent waiting for work
+      long failed_tasks;   // tasks whose exception escaped and was dropped (a bug)
+   };
+
+   static TaskScheduler &instance()
+   {
+      static TaskScheduler scheduler;
+      return scheduler;
+   }
+
+   // number of worker threads (the thread calling parallel_for works as well)
+   int size() const
+   { return (int)workers.size(); }
+
+   // restart with n_threads workers (0 picks one less than the number of hardware
+   // threads), optionally pinning worker t to core t; must not be called while any
+   // task is queued or running
+   void configure(int n_threads, bool pin)
+   {
+      stop();
+      if(n_threads<=0) n_threads=std::max(1, (int)std::thread::hardware_concurrency()-1);
+      stopping=false;
+      for(int t=0; t<n_threads; ++t) workers.emplace_back(new Worker);
+      for(int t=0; t<n_threads; ++t){
+         workers[t]->thread=std::thread([this, t](){ run(t); });
+         if(pin) pin_thread(workers[t]->thread, t);
+      }
+      pinned=pin;
+   }
+
+   bool is_pinned() const
+   { return pinned; }
+
+   // queue task to run on some worker; it must not throw (see above)
+   void submit(std::function<void()> task)
+   {
+      int t=current_worker();
+      if(t<0) t=(int)(next_worker++%workers.size());
+      {
+         std::lock_guard<std::mutex> lock(workers[t]->mutex);
+         workers[t]->tasks.push_back(std::move(task));
+      }
+      ++pending;
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      sleep_cv.notify_one();
+   }
+
+   Stats stats() const
+   {
+      Stats s={0, 0, 0.0, 0};
+      for(unsigned int t=0; t<workers.size(); ++t){
+         s.tasks+=workers[t]->tasks_run;
+         s.steals+=workers[t]->steals;
+         s.idle_seconds+=workers[t]->idle_ns*1e-9;
+         s.failed_tasks+=workers[t]->failed;
+      }
+      return s;
+   }
+
+   void reset_stats()
+   {
+      for(unsigned int t=0; t<workers.size(); ++t)
+         workers[t]->tasks_run=workers[t]->steals=workers[t]->idle_ns=workers[t]->failed=0;
+   }
+
+private:
+   struct Worker
+   {
+      std::deque<std::function<void()> > tasks;
+      std::mutex mutex;
+      std::thread thread;
+      std::atomic<long> tasks_run, steals, idle_ns, failed;
+      Worker() : tasks_run(0), steals(0), idle_ns(0), failed(0) {}
+   };
+
+   std::vector<std::unique_ptr<Worker> > workers;
+   std::atomic<long> pending; // tasks queued but not yet taken
+   std::atomic<unsigned long> next_worker;
+   std::mutex sleep_mutex;
+   std::condition_variable sleep_cv;
+   bool stopping, pinned;
+
+   TaskScheduler()
+      : pending(0), next_worker(0), stopping(false), pinned(false)
+   { configure(0, false); }
+
+   ~TaskScheduler()
+   { stop(); }
+
+   // index of the worker running on this thread, or -1 for other threads
+   static int &current_worker()
+   {
+      thread_local int index=-1;
+      return index;
+   }
+
+   static void pin_thread(std::thread &thread, int t)
+   {
+#ifdef __linux__
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(t%std::max(1u, std::thread::hardware_concurrency()), &cpus);
+      pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#else
+      (void)thread; (void)t;
+#endif
+   }
+
+   void stop()
+   {
+      {
+         std::lock_guard<std::mutex> lock(sleep_mutex);
+         stopping=true;
+      }
+      sleep_cv.notify_all();
+      for(unsigned int t=0; t<workers.size(); ++t) workers[t]->thread.join();
+      workers.clear();
+   }
+
+   bool pop_local(int t, std::function<void()> &task)
+   {
+      Worker &w=*workers[t];
+      std::lock_guard<std::mutex> lock(w.mutex);
+      if(w.tasks.empty()) return false;
+      task=std::move(w.tasks.back());
+      w.tasks.pop_back();
+      return true;
+   }
+
+   bool steal(int t, std::function<void()> &task)
+   {
+      int n=(int)workers.size();
+      for(int v=1; v<n; ++v){
+         Worker &victim=*workers[(t+v)%n];
+         std::lock_guard<std::mutex> lock(victim.mutex);
+         if(victim.tasks.empty()) continue;
+         task=std::move(victim.tasks.front());
+         victim.tasks.pop_front();
+         ++workers[t]->steals;
+         return true;
+      }
+      return false;
+   }
+
+   void run(int t)
+   {
+      current_worker()=t;
+      for(;;){
+         std::function<void()> task;
+         if(pop_local(t, task) || steal(t, task)){
+            --pending;
+            try{
+               task();
+            }catch(...){
+               ++workers[t]->failed;
+            }
+            ++workers[t]->tasks_run;
+            continue;
+         }
+         std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+         std::unique_lock<std::mutex> lock(sleep_mutex);
+         sleep_cv.wait(lock, [this](){ return stopping || pending>0; });
+         workers[t]->idle_ns+=(long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now()-start).count();
+         if(stopping && pending==0) return;
+      }
+   }
+};
+
+// call f(i) for every i in [begin,end), split into chunks that are handed out to the
+// shared scheduler; f must be safe to call concurrently for different i. The calling
+// thread takes chunks too and only waits for chunks already running elsewhere, so
+// nested calls (e.g. from a batch job running on the scheduler) cannot deadlock.
+// If f throws, the chunks not yet started are skipped and the first exception is
+// rethrown here once the chunks already running are done.
+template<class F>
+void parallel_for(int begin, int end, const F &f)
+{
+   int n=end-begin;
+   if(n<=0) return;
+   TaskScheduler &scheduler=TaskScheduler::instance();
+   int n_chunks=std::min(n, 4*(scheduler.size()+1));
+   if(n_chunks==1){
+      for(int i=begin; i<end; ++i) f(i);
+      return;
+   }
+   struct State
+   {
+      std::atomic<int> next, done;
+      std::atomic<bool> failed;
+      std::exception_ptr error; // the first exception thrown by f, guarded by mutex
+      std::mutex mutex;
+      std::condition_variable cv;
+   };
+   std::shared_ptr<State> state=std::make_shared<State>();
+   state->next=0;
+   state->done=0;
+   state->failed=false;
+   const F *fp=&f;
+   // f is only touched after claiming a chunk, and we don't return before every chunk
+   // is done, so helpers that start late never see a dangling f
+   std::function<void()> work=[state, fp, begin, n, n_chunks](){
+      int c;
+      while((c=state->next++)<n_chunks){
+         int b=begin+(int)((long)n*c/n_chunks), e=begin+(int)((long)n*(c+1)/n_chunks);
+         try{
+            if(!state->failed) for(int i=b; i<e; ++i) (*fp)(i);
+         }catch(...){
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if(!state->error) state->error=std::current_exception();
+            state->failed=true;
+         }
+         if(++state->done==n_chunks){
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->cv.notify_all();
+         }
+      }
+   };
+   int n_helpers=std::min(scheduler.size(), n_chunks-1);
+   for(int t=0; t<n_helpers; ++t) scheduler.submit(work);
+   work();
+   std::unique_lock<std::mutex> lock(state->mutex);
+   state->cv.wait(lock, [&state, n_chunks](){ return state->done==n_chunks; });
+   if(state->error) std::rethrow_exception(state->error);
+}
+
+#endif
@@ -2,41 +2,48 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "makelevelset3.h"
+#include "meshfile.h"
+#include "parallel.h"
+#include "resultcache.h"
 
 #define STRINGIFY(x) #x
 #define MACRO_STRINGIFY(x) STRINGIFY(x)
 
 namespace py = pybind11;
 
-py::array_t<float> compute(py::array_t<float> vertices,
-                           py::array_t<unsigned int> faces, int size) {
-  // input
+static std::vector<Vec3f> to_vertices(const py::array_t<float> &vertices) {
   std::vector<Vec3f> V;
+  V.reserve(vertices.shape(0));
   for (int i = 0; i < vertices.shape(0); ++i) {
     V.push_back(Vec3f(vertices.at(i, 0), vertices.at(i, 1), vertices.at(i, 2)));
   }
+  return V;
+}
+
+static std::vector<Vec3ui> to_faces(const py::array_t<unsigned int> &faces) {
   std::vector<Vec3ui> F;
+  F.reserve(faces.shape(0));
   for (int i = 0; i < faces.shape(0); ++i) {
     F.push_back(Vec3ui(faces.at(i, 0), faces.at(i, 1), faces.at(i, 2)));
   }
+  return F;
+}
 
-  // bounding box
-  Vec3f bbmin(-1.0f, -1.0f, -1.0f);
-  Vec3f bbmax(1.0f, 1.0f, 1.0f);
-  float dx = 2.0f / (float)size;
-
-  // compute level sets
-  Array3f grid;
-  make_level_set3(F, V, bbmin, dx, size, size, size, grid);
-
-  // output
-  py::array_t<float> sdf({size, size, size});
-  for (int x = 0; x < size; x++) {
-    for (int y = 0; y < size; y++) {
-      for (int z = 0; z < size; z++) {
+static py::array_t<float> to_numpy(const Array3f &grid) {
+  py::array_t<float> sdf({grid.ni, grid.nj, grid.nk});
+  for (int x = 0; x < grid.ni; x++) {
+    for (int y = 0; y < grid.nj; y++) {
+      for (int z = 0; z < grid.nk; z++) {
         sdf.mutable_at(x, y, z) = grid(x, y, z);
       }
     }
@@ -44,17 +51,787 @@ py::array_t<float> compute(py::array_t<float> vertices,
   return sdf;
 }
 
+// the sampling grid: sample (i,j,k) is at origin + dx * (i,j,k)
+struct Grid {
+  Vec3f origin;
+  float dx;
+  int ni, nj, nk;
+};
+
+// the default grid: size^3 samples over [-1, 1]^3
+static Grid cube_grid(int size) {
+  Grid grid;
+  grid.origin = Vec3f(-1.0f, -1.0f, -1.0f);
+  grid.dx = 2.0f / (float)size;
+  grid.ni = grid.nj = grid.nk = size;
+  return grid;
+}
+
+// a grid over the box given by `bounds`, or over the box mesh_min..mesh_max (the
+// bounding box of the mesh) grown by `padding` cells on each side if `fit` is set;
+// samples are `dx` apart, or spaced so that `size` of them span the longest side of
+// the box including its padding; either way both ends of the box are sampled
+static Grid make_grid(const Vec3f &mesh_min, const Vec3f &mesh_max, int size,
+                      const py::object &bounds, const py::object &dx, bool fit,
+                      int padding) {
+  if (bounds.is_none() && dx.is_none() && !fit) return cube_grid(size);
+
+  Vec3f bbmin(-1.0f, -1.0f, -1.0f), bbmax(1.0f, 1.0f, 1.0f);
+  if (fit) {
+    bbmin = mesh_min;
+    bbmax = mesh_max;
+  } else if (!bounds.is_none()) {
+    auto b = bounds.cast<std::vector<std::vector<float>>>();
+    if (b.size() != 2 || b[0].size() != 3 || b[1].size() != 3)
+      throw std::invalid_argument("bounds must be ((xmin, ymin, zmin), (xmax, ymax, zmax))");
+    bbmin = Vec3f(b[0][0], b[0][1], b[0][2]);
+    bbmax = Vec3f(b[1][0], b[1][1], b[1][2]);
+  }
+  Vec3f extent = bbmax - bbmin;
+  if (min(extent) < 0) throw std::invalid_argument("bounds must have min <= max");
+  int pad = fit ? padding : 0;
+
+  Grid grid;
+  if (!dx.is_none()) {
+    grid.dx = dx.cast<float>();
+  } else {
+    if (size <= 2 * pad + 1) throw std::invalid_argument("size must exceed 2 * padding + 1");
+    grid.dx = padded_grid_spacing(max(extent), size, pad);
+  }
+  if (!(grid.dx > 0)) throw std::invalid_argument("the grid spacing must be positive");
+  grid.origin = bbmin - Vec3f((float)pad * grid.dx);
+  int n[3];
+  for (int a = 0; a < 3; ++a) {
+    n[a] = padded_grid_samples(extent[a], grid.dx, pad);
+  }
+  grid.ni = n[0];
+  grid.nj = n[1];
+  grid.nk = n[2];
+  return grid;
+}
+
+// the same, fitting to the vertices V
+static Grid make_grid(const std::vector<Vec3f> &V, int size,
+                      const py::object &bounds, const py::object &dx, bool fit,
+                      int padding) {
+  Vec3f bbmin(0.0f), bbmax(0.0f);
+  if (fit) {
+    if (V.empty()) throw std::invalid_argument("cannot fit a grid to an empty mesh");
+    bbmin = bbmax = V[0];
+    for (size_t i = 1; i < V.size(); ++i) update_minmax(V[i], bbmin, bbmax);
+  }
+  return make_grid(bbmin, bbmax, size, bounds, dx, fit, padding);
+}
+
+// the region of interest ((i0, j0, k0), (i1, j1, k1)) as cell ranges, or the whole
+// grid if `roi` is None
+static void parse_roi(const py::object &roi, const Grid &grid, Vec3i &roi_min,
+                      Vec3i &roi_max) {
+  roi_min = Vec3i(0, 0, 0);
+  roi_max = Vec3i(grid.ni, grid.nj, grid.nk);
+  if (roi.is_none()) return;
+  auto r = roi.cast<std::vector<std::vector<int>>>();
+  if (r.size() != 2 || r[0].size() != 3 || r[1].size() != 3)
+    throw std::invalid_argument("roi must be ((i0, j0, k0), (i1, j1, k1))");
+  roi_min = Vec3i(r[0][0], r[0][1], r[0][2]);
+  roi_max = Vec3i(r[1][0], r[1][1], r[1][2]);
+  Vec3i dims(grid.ni, grid.nj, grid.nk);
+  for (int a = 0; a < 3; ++a) {
+    if (roi_min[a] < 0 || roi_max[a] <= roi_min[a])
+      throw std::invalid_argument("roi must be a non-empty range of indices");
+    if (roi_max[a] > dims[a])
+      throw std::invalid_argument("roi must lie within the grid of shape (" +
+                                  std::to_string(grid.ni) + ", " +
+                                  std::to_string(grid.nj) + ", " +
+                                  std::to_string(grid.nk) + ")");
+  }
+}
+
+// the SDF, or (sdf, origin, dx) if `return_grid` is set, where origin is the
+// position of the first sample of the region of interest
+static py::object make_result(const py::array &sdf, const Grid &grid,
+                              const Vec3i &roi_min, bool return_grid) {
+  if (!return_grid) return sdf;
+  py::array_t<float> origin(3);
+  for (int a = 0; a < 3; ++a)
+    origin.mutable_at(a) = grid.origin[a] + roi_min[a] * grid.dx;
+  return py::make_tuple(sdf, origin, grid.dx);
+}
+
+static py::object make_result(const Array3f &phi, const Grid &grid,
+                              const Vec3i &roi_min, bool return_grid) {
+  return make_result(to_numpy(phi), grid, roi_min, return_grid);
+}
+
+// the output type requested from compute(); distances are clamped to
+// [-truncation, truncation] and multiplied by scale, which defaults to 1 for the
+// float types and to the largest integer over the truncation for the integer ones
+struct OutputFormat {
+  LevelSetDtype dtype;
+  float truncation, scale;
+  py::dtype np_dtype;
+
+  // the plain float32 SDF, which needs no conversion
+  bool is_default() const {
+    return dtype == level_set_float32 && truncation == 0 && scale == 1;
+  }
+};
+
+static OutputFormat parse_output(const std::string &dtype,
+                                 const py::object &truncation,
+                                 const py::object &scale) {
+  OutputFormat format;
+  float limit = 0;
+  if (dtype == "float32") {
+    format.dtype = level_set_float32;
+  } else if (dtype == "float16") {
+    format.dtype = level_set_float16;
+  } else if (dtype == "int16") {
+    format.dtype = level_set_int16;
+    limit = 32767;
+  } else if (dtype == "int8") {
+    format.dtype = level_set_int8;
+    limit = 127;
+  } else {
+    throw std::invalid_argument("dtype must be float32, float16, int16 or int8");
+  }
+  format.np_dtype = py::dtype::from_args(py::str(dtype));
+  format.truncation = truncation.is_none() ? 0.0f : truncation.cast<float>();
+  if (!truncation.is_none() && !(format.truncation > 0))
+    throw std::invalid_argument("truncation must be positive");
+  if (!scale.is_none()) {
+    format.scale = scale.cast<float>();
+  } else if (limit == 0) {
+    format.scale = 1;
+  } else if (format.truncation > 0) {
+    format.scale = limit / format.truncation;
+  } else {
+    throw std::invalid_argument("integer dtypes need a truncation or a scale");
+  }
+  if (!(format.scale > 0)) throw std::invalid_argument("scale must be positive");
+  return format;
+}
+
+// an uninitialized array of the requested type for an ni x nj x nk grid, in the
+// same (i, j, k) indexing as to_numpy but with Fortran strides, so its buffer is in
+// Array3 order
+static py::array output_array(const OutputFormat &format, int ni, int nj, int nk) {
+  const py::ssize_t f = format.np_dtype.itemsize();
+  return py::array(format.np_dtype, {(py::ssize_t)ni, (py::ssize_t)nj, (py::ssize_t)nk},
+                   {f, f * ni, f * ni * nj});
+}
+
+// the n distances phi converted into a new array of the requested type
+static py::array convert_output(const float *phi, int ni, int nj, int nk,
+                                const OutputFormat &format) {
+  py::array sdf = output_array(format, ni, nj, nk);
+  LevelSetOutput out(format.dtype, format.truncation, format.scale,
+                     sdf.mutable_data());
+  py::gil_scoped_release release;
+  convert_level_set3(phi, (size_t)ni * nj * nk, out);
+  return sdf;
+}
+
+// the cache key of a compute() result: the mesh, and every setting that changes
+// the output
+static CacheKey result_key(const CacheKey &mesh, const Grid &grid,
+                           const Vec3i &roi_min, const Vec3i &roi_max,
+                           int exact_band, int max_iterations,
+                           bool unsigned_distance, int coarsening,
+                           int refine_band, float truncation) {
+  CacheKey key;
+  const int version = 2;  // bump when the core's output changes
+  key.add(version);
+  key.add(mesh.h0);
+  key.add(mesh.h1);
+  key.add(grid.origin);
+  key.add(grid.dx);
+  key.add(Vec3i(grid.ni, grid.nj, grid.nk));
+  key.add(roi_min);
+  key.add(roi_max);
+  key.add(exact_band);
+  key.add(max_iterations);
+  key.add(unsigned_distance);
+  key.add(coarsening > 1 ? coarsening : 1);
+  key.add(coarsening > 1 ? refine_band : 0);
+  key.add(truncation);
+  return key;
+}
+
+// a grid from the cache as a NumPy array using its mapping in place, in the same
+// (i, j, k) indexing as to_numpy but with Fortran strides; the array keeps the
+// mapping alive
+// (converted to the requested type, if that isn't float32)
+static py::object cached_result(std::unique_ptr<CachedGrid> grid,
+                                const OutputFormat &format, bool return_grid) {
+  const SdfHeader h = grid->header;
+  py::array sdf;
+  if (format.is_default()) {
+    CachedGrid *g = grid.release();
+    py::capsule owner(g, [](void *p) { delete static_cast<CachedGrid *>(p); });
+    const py::ssize_t f = sizeof(float);
+    sdf = py::array_t<float>({(py::ssize_t)h.ni, (py::ssize_t)h.nj, (py::ssize_t)h.nk},
+                             {f, f * h.ni, f * h.ni * h.nj}, g->data, owner);
+  } else {
+    sdf = convert_output(grid->data, h.ni, h.nj, h.nk, format);
+  }
+  if (!return_grid) return sdf;
+  py::array_t<float> origin(3);
+  for (int a = 0; a < 3; ++a) origin.mutable_at(a) = (float)h.origin[a];
+  return py::make_tuple(sdf, origin, (float)h.dx);
+}
+
+// compute() for a mesh already converted
+static py::object compute_mesh(const std::vector<Vec3f> &V,
+                               const std::vector<Vec3ui> &F, int size,
+                               int max_iterations, bool unsigned_distance,
+                               py::object bounds, py::object dx, bool fit,
+                               int padding, py::object roi, int coarsening,
+                               int refine_band, bool return_grid,
+                               py::object cache_dir, std::string dtype,
+                               py::object truncation, py::object scale) {
+  OutputFormat format = parse_output(dtype, truncation, scale);
+
+  // bounding box
+  Grid grid = make_grid(V, size, bounds, dx, fit, padding);
+
+  // region of interest
+  Vec3i roi_min, roi_max;
+  parse_roi(roi, grid, roi_min, roi_max);
+  if (coarsening > 1 && !roi.is_none())
+    throw std::invalid_argument("coarsening cannot be combined with roi");
+
+  // the core only cuts sweeping off at the truncation on the full grid
+  const float truncation_cutoff =
+      coarsening <= 1 && roi.is_none() ? format.truncation : 0.0f;
+
+  // cached result
+  std::unique_ptr<ResultCache> cache;
+  CacheKey mesh, key;
+  if (!cache_dir.is_none()) {
+    cache.reset(new ResultCache(cache_dir.cast<std::string>()));
+    mesh = mesh_key(V, F);
+    key = result_key(mesh, grid, roi_min, roi_max, 1, max_iterations,
+                     unsigned_distance, coarsening, refine_band,
+                     truncation_cutoff);
+    std::unique_ptr<CachedGrid> hit = cache->find(key);
+    if (hit) return cached_result(std::move(hit), format, return_grid);
+  }
+
+  // compute level sets; on the full grid a converted result is written straight
+  // from the final pass, so no float grid is kept or copied
+  Array3f phi;
+  if (!cache && coarsening <= 1 && roi.is_none() && !format.is_default()) {
+    py::array sdf = output_array(format, grid.ni, grid.nj, grid.nk);
+    LevelSetOutput out(format.dtype, format.truncation, format.scale,
+                       sdf.mutable_data());
+    {
+      py::gil_scoped_release release;
+      LevelSetScratch scratch;
+      make_level_set3(F, V, grid.origin, grid.dx, grid.ni, grid.nj, grid.nk, out,
+                      phi, scratch, 1, max_iterations, unsigned_distance,
+                      format.truncation);
+    }
+    return make_result(sdf, grid, roi_min, return_grid);
+  }
+  {
+    py::gil_scoped_release release;
+    if (coarsening > 1) {
+      make_level_set3_multires(F, V, grid.origin, grid.dx, grid.ni, grid.nj,
+                               grid.nk, phi, coarsening, refine_band, 1,
+                               max_iterations, unsigned_distance);
+    } else if (roi.is_none()) {
+      make_level_set3(F, V, grid.origin, grid.dx, grid.ni, grid.nj, grid.nk, phi,
+                      1, max_iterations, unsigned_distance, format.truncation);
+    } else {
+      make_level_set3(F, V, grid.origin, grid.dx, roi_min, roi_max, phi, 1,
+                      max_iterations, unsigned_distance);
+    }
+  }
+
+  // output, from the cache entry just written if there is one
+  if (cache) {
+    SdfHeader header;
+    for (int a = 0; a < 3; ++a)
+      header.origin[a] = grid.origin[a] + roi_min[a] * grid.dx;
+    header.dx = grid.dx;
+    header.sign_method = unsigned_distance ? sdf_unsigned : sdf_parity;
+    header.mesh_hash[0] = mesh.h0;
+    header.mesh_hash[1] = mesh.h1;
+    std::unique_ptr<CachedGrid> entry;
+    if (cache->store(key, phi, header)) entry = cache->find(key);
+    if (entry) return cached_result(std::move(entry), format, return_grid);
+  }
+  if (!format.is_default()) {
+    return make_result(convert_output(phi.a.data, phi.ni, phi.nj, phi.nk, format),
+                       grid, roi_min, return_grid);
+  }
+  return make_result(phi, grid, roi_min, return_grid);
+}
+
+py::object compute(py::array_t<float> vertices, py::array_t<unsigned int> faces,
+                   int size, int max_iterations, bool unsigned_distance,
+                   py::object bounds, py::object dx, bool fit, int padding,
+                   py::object roi, int coarsening, int refine_band,
+                   bool return_grid, py::object cache_dir, std::string dtype,
+                   py::object truncation, py::object scale) {
+  return compute_mesh(to_vertices(vertices), to_faces(faces), size,
+                      max_iterations, unsigned_distance, bounds, dx, fit,
+                      padding, roi, coarsening, refine_band, return_grid,
+                      cache_dir, dtype, truncation, scale);
+}
+
+// compute() for a mesh file, read natively so it never goes through NumPy
+py::object compute_from_file(std::string filename, int size, int max_iterations,
+                             bool unsigned_distance, py::object bounds,
+                             py::object dx, bool fit, int padding,
+                             py::object roi, int coarsening, int refine_band,
+                             bool return_grid, py::object cache_dir,
+                             std::string dtype, py::object truncation,
+                             py::object scale) {
+  std::vector<Vec3f> V;
+  std::vector<Vec3ui> F;
+  std::string error;
+  bool loaded;
+  {
+    py::gil_scoped_release release;
+    loaded = load_mesh(filename, V, F, &error);
+  }
+  if (!loaded) throw std::runtime_error(error);
+  return compute_mesh(V, F, size, max_iterations, unsigned_distance, bounds, dx,
+                      fit, padding, roi, coarsening, refine_band, return_grid,
+                      cache_dir, dtype, truncation, scale);
+}
+
+py::object compute_batch(py::list meshes, int size, int max_iterations,
+                         bool unsigned_distance, py::object callback) {
+  struct Job {
+    std::vector<Vec3f> V;
+    std::vector<Vec3ui> F;
+    Array3f grid;
+    std::exception_ptr error;  // what the computation threw, rethrown here
+  };
+
+  const int n = (int)meshes.size();
+  const Grid grid = cube_grid(size);
+
+  // meshes run as tasks on the shared scheduler, and their results are handed
+  // back to this thread (which holds the GIL) through `finished` as they complete;
+  // at most one mesh per worker is in flight, so only that many grids and scratch
+  // buffers are alive at a time, and the scratch buffers are reused across meshes
+  TaskScheduler &scheduler = TaskScheduler::instance();
+  const int max_in_flight = scheduler.size();
+  std::vector<std::unique_ptr<Job>> jobs(n);
+  std::vector<std::unique_ptr<LevelSetScratch>> scratches;
+  std::vector<LevelSetScratch *> free_scratches;
+  std::deque<int> finished;
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  py::list results;
+  if (callback.is_none()) {
+    for (int i = 0; i < n; ++i) results.append(py::none());
+  }
+
+  int submitted = 0, in_flight = 0;
+  auto wait_finished = [&]() {
+    py::gil_scoped_release release;
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return !finished.empty(); });
+    int index = finished.front();
+    finished.pop_front();
+    --in_flight;
+    return index;
+  };
+
+  try {
+    for (int done = 0; done < n; ++done) {
+      while (submitted < n && in_flight < max_in_flight) {
+        py::tuple mesh = meshes[submitted].cast<py::tuple>();
+        std::unique_ptr<Job> job(new Job);
+        job->V = to_vertices(mesh[0].cast<py::array_t<float>>());
+        job->F = to_faces(mesh[1].cast<py::array_t<unsigned int>>());
+        jobs[submitted] = std::move(job);
+        const int index = submitted;
+        // scheduler tasks must not throw: every failure is kept in the job and
+        // the job is always reported finished
+        scheduler.submit([&, index]() {
+          LevelSetScratch *scratch = nullptr;
+          Job &job = *jobs[index];
+          try {
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              if (free_scratches.empty()) {
+                scratches.emplace_back(new LevelSetScratch);
+                free_scratches.push_back(scratches.back().get());
+              }
+              scratch = free_scratches.back();
+              free_scratches.pop_back();
+            }
+            make_level_set3(job.F, job.V, grid.origin, grid.dx, grid.ni, grid.nj,
+                            grid.nk, job.grid, *scratch, 1, max_iterations,
+                            unsigned_distance);
+          } catch (...) {
+            job.error = std::current_exception();
+          }
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (scratch) free_scratches.push_back(scratch);
+            finished.push_back(index);
+          }
+          cv.notify_one();
+        });
+        ++submitted;
+        ++in_flight;
+      }
+
+      int index = wait_finished();
+      if (jobs[index]->error) std::rethrow_exception(jobs[index]->error);
+      py::array_t<float> sdf = to_numpy(jobs[index]->grid);
+      jobs[index].reset();
+      if (callback.is_none()) {
+        results[index] = sdf;
+      } else {
+        callback(index, sdf);
+      }
+    }
+  } catch (...) {
+    // the tasks still running refer to this frame, so let them finish first
+    while (in_flight > 0) wait_finished();
+    throw;
+  }
+
+  if (callback.is_none()) return std::move(results);
+  return py::none();
+}
+
+// a mesh preprocessed once (see LevelSetMesh) for computing its SDF on many grids,
+// e.g. at several resolutions or regions of interest; the scratch grids are kept too,
+// so grids of the same size don't allocate them again
+class SDFContext {
+ public:
+  SDFContext(py::array_t<float> vertices, py::array_t<unsigned int> faces)
+      : mesh_(to_faces(faces), to_vertices(vertices)) {}
+
+  py::object grid(int size, int max_iterations, bool unsigned_distance,
+                  py::object bounds, py::object dx, bool fit, int padding,
+                  py::object roi, bool return_grid) {
+    if (fit && mesh_.x.empty())
+      throw std::invalid_argument("cannot fit a grid to an empty mesh");
+    Grid grid = make_grid(mesh_.bbox_min, mesh_.bbox_max, size, bounds, dx,
+                          fit, padding);
+    Vec3i roi_min, roi_max;
+    parse_roi(roi, grid, roi_min, roi_max);
+
+    Array3f phi;
+    {
+      py::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (roi.is_none()) {
+        make_level_set3(mesh_, grid.origin, grid.dx, grid.ni, grid.nj, grid.nk,
+                        phi, scratch_, 1, max_iterations, unsigned_distance);
+      } else {
+        make_level_set3(mesh_, grid.origin, grid.dx, roi_min, roi_max, phi,
+                        scratch_, 1, max_iterations, unsigned_distance);
+      }
+    }
+    return make_result(phi, grid, roi_min, return_grid);
+  }
+
+  size_t num_vertices() const { return mesh_.x.size(); }
+  size_t num_faces() const { return mesh_.tri.size(); }
+
+ private:
+  const LevelSetMesh mesh_;
+  LevelSetScratch scratch_;  // guarded by mutex_
+  std::mutex mutex_;
+};
+
+// a level set kept alive between edits of its mesh, so that moving a few vertices
+// only recomputes the part of the field the edit affects
+class LevelSet {
+ public:
+  LevelSet(py::array_t<float> vertices, py::array_t<unsigned int> faces,
+           int size, int max_iterations, bool unsigned_distance,
+           py::object bounds, py::object dx, bool fit, int padding)
+      : V_(to_vertices(vertices)), F_(to_faces(faces)),
+        max_iterations_(max_iterations), unsigned_distance_(unsigned_distance) {
+    grid_ = make_grid(V_, size, bounds, dx, fit, padding);
+    py::gil_scoped_release release;
+    make_level_set3(F_, V_, grid_.origin, grid_.dx, grid_.ni, grid_.nj,
+                    grid_.nk, phi_, scratch_, 1, max_iterations_,
+                    unsigned_distance_);
+  }
+
+  py::array_t<float> sdf() const { return to_numpy(phi_); }
+
+  py::array_t<float> update(py::array_t<float> vertices) {
+    std::vector<Vec3f> V = to_vertices(vertices);
+    if (V.size() != V_.size())
+      throw std::invalid_argument("the number of vertices must stay the same");
+    std::vector<char> moved(V.size(), 0);
+    for (size_t i = 0; i < V.size(); ++i) moved[i] = V[i] != V_[i];
+    std::vector<unsigned int> changed;
+    for (unsigned int t = 0; t < F_.size(); ++t) {
+      if (moved[F_[t][0]] || moved[F_[t][1]] || moved[F_[t][2]]) changed.push_back(t);
+    }
+    if (!changed.empty()) {
+      py::gil_scoped_release release;
+      update_level_set3(F_, V_, V, changed, grid_.origin, grid_.dx, phi_,
+                        scratch_, 1, max_iterations_, unsigned_distance_);
+    }
+    V_.swap(V);
+    return sdf();
+  }
+
+ private:
+  std::vector<Vec3f> V_;
+  std::vector<Vec3ui> F_;
+  Grid grid_;
+  int max_iterations_;
+  bool unsigned_distance_;
+  Array3f phi_;
+  LevelSetScratch scratch_;
+};
+
+void set_num_threads(int n_threads, bool pin) {
+  py::gil_scoped_release release;
+  TaskScheduler::instance().configure(n_threads, pin);
+}
+
+int get_num_threads() { return TaskScheduler::instance().size(); }
+
+py::dict scheduler_stats(bool reset) {
+  TaskScheduler &scheduler = TaskScheduler::instance();
+  TaskScheduler::Stats stats = scheduler.stats();
+  if (reset) scheduler.reset_stats();
+  py::dict d;
+  d["threads"] = scheduler.size();
+  d["pinned"] = scheduler.is_pinned();
+  d["tasks"] = stats.tasks;
+  d["steals"] = stats.steals;
+  d["idle_seconds"] = stats.idle_seconds;
+  d["failed_tasks"] = stats.failed_tasks;
+  return d;
+}
+
+py::dict disk_stats(bool reset) {
+  DiskArrayStats stats = disk_array_stats(reset);
+  py::dict d;
+  d["files"] = stats.files;
+  d["bytes"] = stats.bytes;
+  d["live_bytes"] = stats.live_bytes;
+  d["peak_bytes"] = stats.peak_bytes;
+  return d;
+}
+
 PYBIND11_MODULE(core, m) {
   m.def("compute", &compute, R"pbdoc(
         Compute the SDF from an input mesh.
 
         Args:
           vertices (np.ndarray): The vertex array with shape (Nv, 3), and
-              vertices MUST be in range [-1, 1].
+              vertices MUST be inside the grid, which is [-1, 1]^3 by default.
+          faces (np.ndarray): The face array with shape (Nf, 3).
+          size (int): The resolution of resulting SDF. When `bounds` or `fit`
+              is given, it is the number of cells along the longest side.
+          max_iterations (int): The maximum number of fast sweeping rounds;
+              sweeping stops earlier once a round makes no update.
+          unsigned (bool): If True, skip the inside/outside test and return
+              the unsigned distance field.
+          bounds (tuple): The box ((xmin, ymin, zmin), (xmax, ymax, zmax))
+              covered by the grid; the grid is not cubic if the box is not.
+          dx (float): The cell size; overrides `size`.
+          fit (bool): If True, fit the grid to the bounding box of the mesh
+              instead of `bounds`.
+          padding (int): The number of cells added on each side when `fit`
+              is True.
+          roi (tuple): If given as ((i0, j0, k0), (i1, j1, k1)), only the
+              cells [i0, i1) x [j0, j1) x [k0, k1) of the grid are computed,
+              and the result has shape (i1 - i0, j1 - j0, k1 - k0). The range
+              must lie within the grid.
+          coarsening (int): If greater than 1, first compute the SDF on a
+              grid with cells `coarsening` times larger, refine only where it
+              is within `refine_band` cells of the surface, and interpolate
+              the coarse values elsewhere. Faster, but the far field is
+              approximate.
+          refine_band (int): The width in cells of the refined band.
+          return_grid (bool): If True, return (sdf, origin, dx), where the
+              sample sdf[i, j, k] is at origin + dx * (i, j, k).
+          cache_dir (str): If given, results are cached in this directory,
+              keyed by a hash of the mesh and every setting above. A cached
+              result is returned as a copy-on-write view of the mapped file,
+              without recomputing or copying it.
+          dtype (str): The type of the result: 'float32', 'float16', or the
+              fixed-point 'int16' or 'int8'. The conversion is done as the
+              distances are finished, so no float32 grid is returned or
+              copied, and any type other than float32 comes back in Fortran
+              order.
+          truncation (float): If given, distances are clamped to
+              [-truncation, truncation] before scaling. On the full grid
+              (without `roi` or `coarsening`) the sweeps then stop at that
+              distance, and cells further from the surface only get their
+              sign, which is much faster on large grids.
+          scale (float): The factor applied to the (clamped) distances; the
+              integer types store the scaled distance rounded to nearest and
+              saturated. Defaults to 1 for the float types, and to 32767 or
+              127 over `truncation` for the integer ones, so that the range
+              [-truncation, truncation] fills the integers.
+        )pbdoc",
+        py::arg("vertices"), py::arg("faces"), py::arg("size") = 128,
+        py::arg("max_iterations") = 2, py::arg("unsigned") = false,
+        py::arg("bounds") = py::none(), py::arg("dx") = py::none(),
+        py::arg("fit") = false, py::arg("padding") = 2,
+        py::arg("roi") = py::none(), py::arg("coarsening") = 1,
+        py::arg("refine_band") = 4, py::arg("return_grid") = false,
+        py::arg("cache_dir") = py::none(), py::arg("dtype") = "float32",
+        py::arg("truncation") = py::none(), py::arg("scale") = py::none());
+
+  m.def("compute_from_file", &compute_from_file, R"pbdoc(
+        Compute the SDF of a mesh file.
+
+        The file is read natively, without going through NumPy: Wavefront
+        OBJ (polygons are split into triangles), binary PLY, or binary STL,
+        whose corners at the same position are welded into shared vertices.
+        The format is picked by the file's extension.
+
+        Args:
+          filename (str): The .obj, .ply or .stl file.
+          size, max_iterations, unsigned, bounds, dx, fit, padding, roi,
+          coarsening, refine_band, return_grid, cache_dir, dtype,
+          truncation, scale: As in :func:`compute`.
+        )pbdoc",
+        py::arg("filename"), py::arg("size") = 128,
+        py::arg("max_iterations") = 2, py::arg("unsigned") = false,
+        py::arg("bounds") = py::none(), py::arg("dx") = py::none(),
+        py::arg("fit") = false, py::arg("padding") = 2,
+        py::arg("roi") = py::none(), py::arg("coarsening") = 1,
+        py::arg("refine_band") = 4, py::arg("return_grid") = false,
+        py::arg("cache_dir") = py::none(), py::arg("dtype") = "float32",
+        py::arg("truncation") = py::none(), py::arg("scale") = py::none());
+
+  m.def("compute_batch", &compute_batch, R"pbdoc(
+        Compute the SDFs of many meshes in one call.
+
+        The meshes are processed concurrently on the shared scheduler, which
+        also runs the parallel stages inside each mesh, and the scratch grids
+        are reused between meshes.
+
+        Args:
+          meshes (list): A list of (vertices, faces) tuples, with the same
+              requirements as in :func:`compute`.
+          size (int): The resolution of resulting SDFs.
+          max_iterations (int): The maximum number of fast sweeping rounds.
+          unsigned (bool): If True, return unsigned distance fields.
+          callback (callable): If given, ``callback(index, sdf)`` is called
+              for each mesh as soon as it is finished (in completion order)
+              and nothing is returned; otherwise the SDFs are returned as a
+              list in input order.
+        )pbdoc",
+        py::arg("meshes"), py::arg("size") = 128, py::arg("max_iterations") = 2,
+        py::arg("unsigned") = false, py::arg("callback") = py::none());
+
+  py::class_<SDFContext>(m, "SDFContext", R"pbdoc(
+        A mesh prepared once for computing its SDF on many grids.
+
+        The vertices and faces are converted, the bounding boxes of the mesh
+        and its triangles found and the triangles binned on a coarse grid
+        once, and the scratch grids are reused between calls. Regions of
+        interest use the bins to find the triangles near them and those
+        crossing their rows without visiting every triangle, so computing the
+        same mesh at several resolutions, bounds or regions of interest only
+        repeats the work that depends on the grid. :class:`LevelSet` doesn't
+        use a context, since its vertices move.
+
+        Args:
+          vertices (np.ndarray): The vertex array with shape (Nv, 3).
           faces (np.ndarray): The face array with shape (Nf, 3).
-          size (int): The resolution of resulting SDF.
+        )pbdoc")
+      .def(py::init<py::array_t<float>, py::array_t<unsigned int>>(),
+           py::arg("vertices"), py::arg("faces"))
+      .def("grid", &SDFContext::grid, R"pbdoc(
+        Compute the SDF of the mesh on a grid.
+
+        Calls on the same context run one at a time.
+
+        Args:
+          size, max_iterations, unsigned, bounds, dx, fit, padding, roi,
+          return_grid: As in :func:`compute`.
+        )pbdoc",
+           py::arg("size") = 128, py::arg("max_iterations") = 2,
+           py::arg("unsigned") = false, py::arg("bounds") = py::none(),
+           py::arg("dx") = py::none(), py::arg("fit") = false,
+           py::arg("padding") = 2, py::arg("roi") = py::none(),
+           py::arg("return_grid") = false)
+      .def_property_readonly("num_vertices", &SDFContext::num_vertices)
+      .def_property_readonly("num_faces", &SDFContext::num_faces);
+
+  py::class_<LevelSet>(m, "LevelSet", R"pbdoc(
+        An SDF that is kept up to date as the vertices of its mesh move.
+
+        The constructor computes the SDF like :func:`compute`, and keeps the
+        state needed to update it, so that moving a few vertices costs time in
+        proportion to the size of the edit rather than of the grid. Values
+        within a cell of the surface and all signs match a full recomputation;
+        the far field may differ slightly.
+
+        Args:
+          vertices, faces, size, max_iterations, unsigned, bounds, dx, fit,
+          padding: As in :func:`compute`.
+        )pbdoc")
+      .def(py::init<py::array_t<float>, py::array_t<unsigned int>, int, int,
+                    bool, py::object, py::object, bool, int>(),
+           py::arg("vertices"), py::arg("faces"), py::arg("size") = 128,
+           py::arg("max_iterations") = 2, py::arg("unsigned") = false,
+           py::arg("bounds") = py::none(), py::arg("dx") = py::none(),
+           py::arg("fit") = false, py::arg("padding") = 2)
+      .def("sdf", &LevelSet::sdf, "Return the current SDF.")
+      .def("update", &LevelSet::update, R"pbdoc(
+        Move the vertices of the mesh and return the updated SDF.
+
+        Args:
+          vertices (np.ndarray): The new vertex array, with the same shape
+              as before; the faces and the grid stay the same.
+        )pbdoc",
+           py::arg("vertices"));
+
+  m.def("set_num_threads", &set_num_threads, R"pbdoc(
+        Restart the worker threads shared by all parallel computations.
+
+        Must not be called while a computation is running.
+
+        Args:
+          n_threads (int): The number of worker threads; 0 uses one less than
+              the number of hardware threads, as the calling thread also works.
+          pin (bool): If True, pin each worker thread to its own core.
+        )pbdoc",
+        py::arg("n_threads") = 0, py::arg("pin") = false);
+
+  m.def("get_num_threads", &get_num_threads,
+        "Return the number of worker threads.");
+
+  m.def("scheduler_stats", &scheduler_stats, R"pbdoc(
+        Return the scheduler counters as a dict with the number of worker
+        threads, whether they are pinned, the number of tasks run, the number of
+        tasks stolen from another worker, the total worker idle time, and the
+        number of tasks that raised an exception nothing could receive (which
+        should stay 0).
+
+        Args:
+          reset (bool): If True, reset the counters after reading them.
+        )pbdoc",
+        py::arg("reset") = false);
+
+  m.def("disk_stats", &disk_stats, R"pbdoc(
+        Return the totals of the disk-backed grids as a dict with the number of
+        backing files created, the bytes allocated in them, the bytes mapped
+        now and the most bytes mapped at once.
+
+        Args:
+          reset (bool): If True, restart the file and byte counts, and the peak
+              from what is mapped now, after reading them.
         )pbdoc",
-        py::arg("vertices"), py::arg("faces"), py::arg("size") = 128);
+        py::arg("reset") = false);
 
 #ifdef VERSION_INFO
   m.attr("__version__") = MACRO_STRINGIFY(VERSION_INFO);
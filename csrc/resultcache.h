@@ -0,0 +1,135 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "array3.h"
+#include "diskarray1.h"
+#include "sdffile.h"
+#include "vec.h"
+
+// 64-bit hash of a byte buffer, a word at a time (MurmurHash64A)
+inline uint64_t hash_bytes(const void* data, size_t bytes, uint64_t seed) {
+   const uint64_t m = 0xc6a4a7935bd1e995ull;
+   const int r = 47;
+   uint64_t h = seed ^ (bytes * m);
+   const unsigned char* p = (const unsigned char*)data;
+   const unsigned char* end = p + (bytes & ~(size_t)7);
+   for (; p != end; p += 8) {
+      uint64_t k;
+      std::memcpy(&k, p, 8);
+      k *= m; k ^= k >> r; k *= m;
+      h ^= k; h *= m;
+   }
+   switch (bytes & 7) {
+      case 7: h ^= uint64_t(p[6]) << 48; // fall through
+      case 6: h ^= uint64_t(p[5]) << 40; // fall through
+      case 5: h ^= uint64_t(p[4]) << 32; // fall through
+      case 4: h ^= uint64_t(p[3]) << 24; // fall through
+      case 3: h ^= uint64_t(p[2]) << 16; // fall through
+      case 2: h ^= uint64_t(p[1]) << 8;  // fall through
+      case 1: h ^= uint64_t(p[0]); h *= m;
+   }
+   h ^= h >> r; h *= m; h ^= h >> r;
+   return h;
+}
+
+// A cache key built up from buffers and values; two independent 64-bit hashes are
+// kept so that accidental collisions are out of the question in practice
+struct CacheKey {
+   uint64_t h0, h1;
+
+   CacheKey() : h0(0x6d65736832736466ull), h1(0x9e3779b97f4a7c15ull) {}
+
+   void add(const void* data, size_t bytes) {
+      h0 = hash_bytes(data, bytes, h0);
+      h1 = hash_bytes(data, bytes, h1 ^ 0x5bd1e9955bd1e995ull);
+   }
+   template<class T>
+   void add(const T& value) { add(&value, sizeof(T)); }
+
+   std::string str() const {
+      char s[33];
+      std::snprintf(s, sizeof(s), "%016llx%016llx", (unsigned long long)h0, (unsigned long long)h1);
+      return s;
+   }
+};
+
+// the hash of a mesh as it is passed to the core, which also goes into .sdf headers
+inline CacheKey mesh_key(const std::vector<Vec3f>& x, const std::vector<Vec3ui>& tri) {
+   CacheKey key;
+   key.add(x.size());
+   if (!x.empty()) key.add(&x[0], x.size() * sizeof(Vec3f));
+   key.add(tri.size());
+   if (!tri.empty()) key.add(&tri[0], tri.size() * sizeof(Vec3ui));
+   return key;
+}
+
+// A grid read from the cache, mapped copy-on-write so it can be handed out without
+// copying and still be written to; phi(i,j,k) is data[i + ni*(j + nj*k)]
+struct CachedGrid {
+   SdfHeader header;
+   float* data;
+
+   CachedGrid(void* map_, size_t map_bytes_, const SdfHeader& header_)
+      : header(header_), data((float*)((char*)map_ + header_.data_offset)),
+        map(map_), map_bytes(map_bytes_) {}
+   ~CachedGrid() { munmap(map, map_bytes); }
+
+private:
+   void* map;
+   size_t map_bytes;
+
+   CachedGrid(const CachedGrid&);
+   CachedGrid& operator=(const CachedGrid&);
+};
+
+// A directory of computed grids, one dense .sdf file per key, so an entry can be
+// mapped and used in place. Files are written under a temporary name and renamed,
+// so concurrent writers and readers only ever see complete entries.
+class ResultCache {
+public:
+   explicit ResultCache(const std::string& dir_) : dir(dir_) {
+      if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+         throw std::runtime_error("cannot create cache directory " + dir);
+   }
+
+   // the grid stored under key, or null if there is none (or it is unreadable)
+   std::unique_ptr<CachedGrid> find(const CacheKey& key) const {
+      std::unique_ptr<CachedGrid> grid;
+      SdfFile file;
+      if (!file.open(path(key)) || file.chunked()) return grid;
+      void* map = file.map();
+      if (map) grid.reset(new CachedGrid(map, file.mapped_bytes(), file.header()));
+      return grid;
+   }
+
+   // store phi under key, with the origin, dx, sign method and mesh hash in header;
+   // returns false if it could not be written
+   bool store(const CacheKey& key, const Array3f& phi, SdfHeader header) const {
+      header.chunk_size = 0;
+      std::string final_path = path(key);
+      std::string tmp_path = final_path + "." + generate_uuid() + ".tmp";
+      bool ok = write_sdf(tmp_path, phi, header);
+      if (ok) ok = rename(tmp_path.c_str(), final_path.c_str()) == 0;
+      if (!ok) unlink(tmp_path.c_str());
+      return ok;
+   }
+
+private:
+   std::string dir;
+
+   std::string path(const CacheKey& key) const { return dir + "/" + key.str() + ".sdf"; }
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,153 @@
+#ifndef SDF_CODEC_H
+#define SDF_CODEC_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// The chunk codec of .sdf files (codec sdf_codec_delta, see sdffile.h). A chunk is a
+// run of rows of row_length samples. Each sample becomes an integer - its float bits
+// mapped to an order-preserving int, or, for lossy chunks, its value divided by the
+// quantization step and rounded - and is predicted from the samples before it in its
+// row. The prediction errors are zigzag-coded and written as LEB128 varints, so a
+// smooth field costs about a byte per sample. The payload starts with one byte giving
+// the chunk's kind.
+
+enum SdfChunkKind {
+   sdf_chunk_raw = 0,       // the floats as they are, when coding would not make them smaller
+   sdf_chunk_lossless = 1,  // coded float bits
+   sdf_chunk_quantized = 2  // a float step, then coded multiples of it
+};
+
+// the float's bits as an int that orders the same way the floats do (and back)
+inline int32_t sdf_ordered_bits(float v) {
+   int32_t i;
+   std::memcpy(&i, &v, 4);
+   return i < 0 ? i ^ 0x7fffffff : i;
+}
+
+inline float sdf_from_ordered_bits(int32_t i) {
+   if (i < 0) i ^= 0x7fffffff;
+   float v;
+   std::memcpy(&v, &i, 4);
+   return v;
+}
+
+namespace sdf_detail {
+   // Each sample of q is predicted from the ones before it: by the linear extrapolation
+   // of the two previous samples in its row (which is exact for a distance field with a
+   // constant gradient), by the previous sample if there's just one, and for the first
+   // sample of a row by the first sample of the previous row.
+
+   // append the zigzag-coded prediction errors of q, in rows of row_length, as varints
+   inline void put_predicted(const std::vector<int64_t>& q, int row_length,
+                             std::vector<unsigned char>& out) {
+      size_t start = out.size();
+      out.resize(start + 10 * q.size());
+      unsigned char* p = &out[0] + start;
+      for (size_t r = 0; r < q.size(); r += row_length) {
+         const int64_t* row = &q[r];
+         for (int i = 0; i < row_length; ++i) {
+            int64_t predicted = i > 1 ? 2 * row[i - 1] - row[i - 2] : i == 1 ? row[0] : r ? row[-row_length] : 0;
+            int64_t d = row[i] - predicted;
+            uint64_t u = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+            while (u >= 0x80) {
+               *p++ = (unsigned char)(u | 0x80);
+               u >>= 7;
+            }
+            *p++ = (unsigned char)u;
+         }
+      }
+      out.resize(p - &out[0]);
+   }
+
+   inline bool get_predicted(const unsigned char* p, const unsigned char* end, size_t n_samples,
+                             int row_length, std::vector<int64_t>& q) {
+      q.resize(n_samples);
+      for (size_t r = 0; r < n_samples; r += row_length) {
+         int64_t* row = &q[r];
+         for (int i = 0; i < row_length; ++i) {
+            uint64_t u = 0;
+            for (int shift = 0;; shift += 7) {
+               if (p == end || shift >= 64) return false;
+               unsigned char b = *p++;
+               u |= (uint64_t)(b & 0x7f) << shift;
+               if (b < 0x80) break;
+            }
+            int64_t d = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+            int64_t predicted = i > 1 ? 2 * row[i - 1] - row[i - 2] : i == 1 ? row[0] : r ? row[-row_length] : 0;
+            row[i] = predicted + d;
+         }
+      }
+      return p == end;
+   }
+}
+
+// Encode the n samples v (rows of row_length, n a multiple of it) into out. If tolerance
+// is positive and no sample is within exact_distance of the surface, the samples are
+// quantized with an error of at most tolerance (up to the rounding of the decoded
+// floats); otherwise they are kept exactly.
+inline void encode_sdf_chunk(const float* v, size_t n, int row_length, float tolerance,
+                             float exact_distance, std::vector<unsigned char>& out) {
+   out.clear();
+   std::vector<int64_t> q(n);
+   bool quantize = tolerance > 0;
+   for (size_t i = 0; i < n && quantize; ++i) quantize = std::fabs(v[i]) >= exact_distance;
+   float step = 2 * tolerance;
+   if (quantize) {
+      // quantizing is only worth it while the multiples stay well inside an int
+      for (size_t i = 0; i < n && quantize; ++i) quantize = std::fabs(v[i]) < 1e9f * step;
+   }
+   if (quantize) {
+      out.push_back(sdf_chunk_quantized);
+      out.insert(out.end(), (const unsigned char*)&step, (const unsigned char*)&step + 4);
+      const float inv_step = 1 / step;
+      for (size_t i = 0; i < n; ++i) {
+         q[i] = (int64_t)std::nearbyint(v[i] * inv_step);
+         // v*inv_step can round the wrong way; keep the error within tolerance
+         if (std::fabs(q[i] * step - v[i]) > tolerance) q[i] += v[i] > q[i] * step ? 1 : -1;
+      }
+   } else {
+      out.push_back(sdf_chunk_lossless);
+      for (size_t i = 0; i < n; ++i) q[i] = sdf_ordered_bits(v[i]);
+   }
+   sdf_detail::put_predicted(q, row_length, out);
+   if (out.size() >= 1 + 4 * n) {
+      out.resize(1 + 4 * n);
+      out[0] = sdf_chunk_raw;
+      std::memcpy(&out[1], v, 4 * n);
+   }
+}
+
+// Decode a chunk of n samples (rows of row_length) written by encode_sdf_chunk;
+// returns false if the payload is malformed
+inline bool decode_sdf_chunk(const unsigned char* p, size_t bytes, int row_length,
+                             float* v, size_t n) {
+   if (bytes < 1) return false;
+   const unsigned char* end = p + bytes;
+   int kind = *p++;
+   if (kind == sdf_chunk_raw) {
+      if (bytes != 1 + 4 * n) return false;
+      std::memcpy(v, p, 4 * n);
+      return true;
+   }
+   std::vector<int64_t> q;
+   if (kind == sdf_chunk_lossless) {
+      if (!sdf_detail::get_predicted(p, end, n, row_length, q)) return false;
+      for (size_t i = 0; i < n; ++i) v[i] = sdf_from_ordered_bits((int32_t)q[i]);
+      return true;
+   }
+   if (kind == sdf_chunk_quantized) {
+      if (bytes < 5) return false;
+      float step;
+      std::memcpy(&step, p, 4);
+      p += 4;
+      if (!sdf_detail::get_predicted(p, end, n, row_length, q)) return false;
+      for (size_t i = 0; i < n; ++i) v[i] = q[i] * step;
+      return true;
+   }
+   return false;
+}
+
+#endif // SDF_CODEC_H
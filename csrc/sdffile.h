@@ -0,0 +1,406 @@
+#ifndef SDF_FILE_H
+#define SDF_FILE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "array3.h"
+#include "parallel.h"
+#include "sdfcodec.h"
+#include "vec.h"
+
+// The .sdf container: a fixed 128-byte header, an optional chunk table, and the samples,
+// all little-endian. Sample (i,j,k) is at origin + dx*(i,j,k). The header, table and
+// samples are written from memory as they are, and dense files are mapped and used in
+// place, so only little-endian hosts are supported (checked below).
+// - Without chunks (chunk_size 0) the samples are one dense array in Array3 order
+//   (i fastest) at data_offset, which is 64-byte aligned, so the file can be mapped
+//   and used in place (e.g. np.memmap with order='F' and shape (ni, nj, nk)).
+// - With chunks, the grid is cut into cubes of chunk_size samples (smaller at the +
+//   edges), numbered i fastest. Each chunk's samples are stored contiguously in Array3
+//   order at the (offset, bytes) given by its entry in the chunk table, so a sub-volume
+//   can be read without touching the rest of the file.
+// - Chunked files may be compressed (codec sdf_codec_delta): each chunk's payload is
+//   then coded by encode_sdf_chunk (see sdfcodec.h), and a chunk whose samples are all
+//   the same (to within tolerance) is elided - its table entry has 0 bytes and the
+//   value's float bits as its offset.
+
+enum SdfDtype { sdf_float32 = 0 };
+
+enum SdfCodec {
+   sdf_codec_none = 0,  // chunks are plain floats
+   sdf_codec_delta = 1  // chunks are elided or coded by encode_sdf_chunk
+};
+
+enum SdfSignMethod {
+   sdf_unsigned = 0, // distances only
+   sdf_parity = 1,   // signs from ray intersection parities (make_level_set3)
+   sdf_fixed = 2     // signs from the surface extracted around the mesh (mesh2sdf.compute fix=True)
+};
+
+static const uint32_t sdf_format_version = 2; // version 1 had no codec
+
+struct SdfHeader {
+   char magic[8];                 // "MESH2SDF"
+   uint32_t version;              // sdf_format_version
+   uint32_t dtype;                // SdfDtype
+   int32_t ni, nj, nk;
+   uint32_t sign_method;          // SdfSignMethod
+   double origin[3];
+   double dx;
+   uint64_t mesh_hash[2];         // hash of the input mesh, zero if unknown
+   uint32_t chunk_size;           // 0 for a dense array
+   uint32_t chunk_count;
+   uint64_t chunk_table_offset;   // chunk_count pairs of uint64 (offset, bytes)
+   uint64_t data_offset;          // start of the samples, 64-byte aligned
+   uint64_t data_bytes;           // bytes from data_offset to the end of the samples
+   uint32_t codec;                // SdfCodec, for chunked files
+   float tolerance;               // largest error of elided or quantized chunks
+   char reserved[8];
+
+   SdfHeader() {
+      std::memset(this, 0, sizeof(*this));
+      std::memcpy(magic, "MESH2SDF", 8);
+      version = sdf_format_version;
+   }
+
+   size_t sample_bytes() const { return 4; }
+   int chunks_i() const { return chunk_size ? (ni + chunk_size - 1) / chunk_size : 1; }
+   int chunks_j() const { return chunk_size ? (nj + chunk_size - 1) / chunk_size : 1; }
+   int chunks_k() const { return chunk_size ? (nk + chunk_size - 1) / chunk_size : 1; }
+};
+static_assert(sizeof(SdfHeader) == 128, "the .sdf header is 128 bytes");
+static_assert(offsetof(SdfHeader, ni) == 16 && offsetof(SdfHeader, origin) == 32 &&
+              offsetof(SdfHeader, mesh_hash) == 64 && offsetof(SdfHeader, chunk_table_offset) == 88 &&
+              offsetof(SdfHeader, codec) == 112 && offsetof(SdfHeader, reserved) == 120,
+              "the .sdf header fields are where mesh2sdf/sdffile.py reads them");
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error ".sdf files are little-endian and written from memory as they are: big-endian hosts are not supported"
+#endif
+
+inline uint64_t sdf_align64(uint64_t offset) { return (offset + 63) & ~(uint64_t)63; }
+
+// the range [lo, hi) of samples along one axis covered by chunk c
+inline void sdf_chunk_range(int c, int chunk_size, int n, int& lo, int& hi) {
+   lo = c * chunk_size;
+   hi = lo + chunk_size < n ? lo + chunk_size : n;
+}
+
+namespace sdf_detail {
+   inline bool write_all(int fd, const void* data, size_t bytes, uint64_t offset) {
+      const char* p = (const char*)data;
+      while (bytes > 0) {
+         ssize_t w = pwrite(fd, p, bytes, offset);
+         if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+         }
+         p += w; bytes -= w; offset += w;
+      }
+      return true;
+   }
+
+   inline bool read_all(int fd, void* data, size_t bytes, uint64_t offset) {
+      char* p = (char*)data;
+      while (bytes > 0) {
+         ssize_t r = pread(fd, p, bytes, offset);
+         if (r < 0 && errno == EINTR) continue;
+         if (r <= 0) return false;
+         p += r; bytes -= r; offset += r;
+      }
+      return true;
+   }
+}
+
+// what write_sdf did
+struct SdfWriteStats {
+   uint64_t raw_bytes;       // the size of the samples as floats
+   uint64_t file_bytes;
+   uint32_t chunks, elided_chunks, quantized_chunks;
+   double seconds;
+
+   SdfWriteStats() : raw_bytes(0), file_bytes(0), chunks(0), elided_chunks(0), quantized_chunks(0),
+                     seconds(0) {}
+
+   double ratio() const { return file_bytes ? (double)raw_bytes / file_bytes : 0; }
+   double gb_per_second() const { return seconds > 0 ? raw_bytes / seconds * 1e-9 : 0; }
+};
+
+namespace sdf_detail {
+   // the samples of chunk (ci,cj,ck) in Array3 order
+   inline void gather_chunk(const Array3f& phi, int cs, int ci, int cj, int ck, std::vector<float>& chunk,
+                            int& row_length) {
+      int i0, i1, j0, j1, k0, k1;
+      sdf_chunk_range(ci, cs, phi.ni, i0, i1);
+      sdf_chunk_range(cj, cs, phi.nj, j0, j1);
+      sdf_chunk_range(ck, cs, phi.nk, k0, k1);
+      chunk.clear();
+      for (int k = k0; k < k1; ++k)
+         for (int j = j0; j < j1; ++j)
+            chunk.insert(chunk.end(), &phi(i0, j, k), &phi(i0, j, k) + (i1 - i0));
+      row_length = i1 - i0;
+   }
+
+   // if the chunk can be elided, set value to what it is elided to
+   inline bool constant_chunk(const std::vector<float>& chunk, float tolerance, float exact_distance,
+                              float& value) {
+      if (tolerance <= 0) {
+         for (size_t n = 1; n < chunk.size(); ++n)
+            if (std::memcmp(&chunk[n], &chunk[0], 4) != 0) return false;
+         value = chunk[0];
+         return true;
+      }
+      float lo = chunk[0], hi = chunk[0];
+      for (size_t n = 0; n < chunk.size(); ++n) {
+         if (!(std::fabs(chunk[n]) >= exact_distance)) return false;
+         lo = min(lo, chunk[n]);
+         hi = max(hi, chunk[n]);
+      }
+      value = lo + 0.5f * (hi - lo);
+      return hi - value <= tolerance && value - lo <= tolerance;
+   }
+}
+
+// Write phi as a .sdf file; header gives origin, dx, sign_method, mesh_hash, chunk_size
+// and, for chunked files, codec and tolerance, and the rest of it is filled in. With
+// sdf_codec_delta, chunks with no sample within exact_distance of the surface may be
+// elided or quantized with an error of at most tolerance; the others are kept exactly.
+// Chunks are encoded in parallel, a layer of chunks at a time. If sync is set, the file
+// is flushed to storage (fsync) before it is closed, so it can be renamed into place
+// durably. Returns false on any I/O error.
+inline bool write_sdf(const std::string& path, const Array3f& phi, SdfHeader header,
+                      float exact_distance = 0, SdfWriteStats* stats = 0, bool sync = false) {
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   header.dtype = sdf_float32;
+   header.ni = phi.ni; header.nj = phi.nj; header.nk = phi.nk;
+   if (header.chunk_size == 0) {
+      header.codec = sdf_codec_none;
+      header.chunk_count = 0;
+      header.chunk_table_offset = 0;
+      header.data_offset = sdf_align64(sizeof(SdfHeader));
+      header.data_bytes = (uint64_t)phi.a.size() * sizeof(float);
+   } else {
+      header.chunk_count = header.chunks_i() * header.chunks_j() * header.chunks_k();
+      header.chunk_table_offset = sizeof(SdfHeader);
+      header.data_offset = sdf_align64(header.chunk_table_offset + 16 * (uint64_t)header.chunk_count);
+   }
+   if (header.codec == sdf_codec_none) header.tolerance = 0;
+   int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (fd < 0) return false;
+   bool ok = true;
+   uint32_t elided = 0, quantized = 0;
+   uint64_t end = header.data_offset;
+   if (header.chunk_size == 0) {
+      ok = sdf_detail::write_all(fd, phi.a.data, header.data_bytes, header.data_offset);
+      end += header.data_bytes;
+   } else {
+      const int cs = header.chunk_size, nci = header.chunks_i(), ncj = header.chunks_j();
+      const bool coded = header.codec == sdf_codec_delta;
+      std::vector<uint64_t> table(2 * (size_t)header.chunk_count);
+      std::vector<std::vector<unsigned char> > payloads(nci * ncj);
+      std::vector<char> constant(nci * ncj);
+      std::vector<float> value(nci * ncj);
+      uint64_t offset = header.data_offset;
+      for (int ck = 0; ck < header.chunks_k() && ok; ++ck) {
+         parallel_for(0, nci * ncj, [&](int c) {
+            std::vector<float> chunk;
+            int row_length;
+            sdf_detail::gather_chunk(phi, cs, c % nci, c / nci, ck, chunk, row_length);
+            std::vector<unsigned char>& out = payloads[c];
+            constant[c] = coded && sdf_detail::constant_chunk(chunk, header.tolerance, exact_distance, value[c]);
+            if (constant[c]) {
+               out.clear();
+            } else if (coded) {
+               encode_sdf_chunk(&chunk[0], chunk.size(), row_length, header.tolerance, exact_distance, out);
+            } else {
+               out.assign((const unsigned char*)&chunk[0], (const unsigned char*)(&chunk[0] + chunk.size()));
+            }
+         });
+         for (int c = 0; c < nci * ncj && ok; ++c) {
+            size_t entry = 2 * (c + (size_t)nci * ncj * ck);
+            if (constant[c]) {
+               uint32_t bits;
+               std::memcpy(&bits, &value[c], 4);
+               table[entry] = bits;
+               table[entry + 1] = 0;
+               ++elided;
+               continue;
+            }
+            if (coded && payloads[c][0] == sdf_chunk_quantized) ++quantized;
+            table[entry] = offset;
+            table[entry + 1] = payloads[c].size();
+            ok = sdf_detail::write_all(fd, &payloads[c][0], payloads[c].size(), offset);
+            end = offset + payloads[c].size();
+            offset = sdf_align64(end);
+         }
+      }
+      header.data_bytes = end - header.data_offset;
+      if (ok) ok = sdf_detail::write_all(fd, &table[0], table.size() * sizeof(uint64_t),
+                                         header.chunk_table_offset);
+   }
+   if (ok) ok = sdf_detail::write_all(fd, &header, sizeof(header), 0);
+   if (ok && sync) ok = fsync(fd) == 0;
+   ok = close(fd) == 0 && ok;
+   if (stats) {
+      stats->raw_bytes = (uint64_t)phi.a.size() * sizeof(float);
+      stats->file_bytes = max(end, (uint64_t)(header.chunk_table_offset + 16 * (uint64_t)header.chunk_count));
+      stats->chunks = header.chunk_count;
+      stats->elided_chunks = elided;
+      stats->quantized_chunks = quantized;
+      stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+   return ok;
+}
+
+// A .sdf file opened for reading. The header and chunk table are read on open; the
+// samples are read on demand, all at once, by region, or mapped in place.
+class SdfFile {
+public:
+   SdfFile() : fd(-1) {}
+   ~SdfFile() { close(); }
+
+   // returns false if the file can't be opened or isn't a valid .sdf file
+   bool open(const std::string& path) {
+      close();
+      fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) return false;
+      struct stat st;
+      if (fstat(fd, &st) != 0 || !sdf_detail::read_all(fd, &h, sizeof(h), 0) ||
+          !valid((uint64_t)st.st_size)) {
+         close();
+         return false;
+      }
+      file_bytes = st.st_size;
+      return true;
+   }
+
+   void close() {
+      if (fd >= 0) ::close(fd);
+      fd = -1;
+      table.clear();
+   }
+
+   const SdfHeader& header() const { return h; }
+   bool chunked() const { return h.chunk_size != 0; }
+
+   // read the samples [lo, hi) (in cell indices, max exclusive) into phi; only the
+   // chunks overlapping the region are read
+   bool read_region(const Vec3i& lo, const Vec3i& hi, Array3f& phi) const {
+      if (fd < 0) return false;
+      for (int a = 0; a < 3; ++a)
+         if (lo[a] < 0 || hi[a] <= lo[a]) return false;
+      if (hi[0] > h.ni || hi[1] > h.nj || hi[2] > h.nk) return false;
+      phi.resize(hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]);
+      if (!chunked()) {
+         // one read per row of the region
+         for (int k = lo[2]; k < hi[2]; ++k)
+            for (int j = lo[1]; j < hi[1]; ++j) {
+               uint64_t offset = h.data_offset + 4 * (lo[0] + (uint64_t)h.ni * (j + (uint64_t)h.nj * k));
+               if (!sdf_detail::read_all(fd, &phi(0, j - lo[1], k - lo[2]), 4 * (size_t)(hi[0] - lo[0]), offset))
+                  return false;
+            }
+         return true;
+      }
+      // the chunks overlapping the region are read and decoded in parallel
+      const int cs = h.chunk_size;
+      const int ci0 = lo[0] / cs, ncri = (hi[0] - 1) / cs - ci0 + 1;
+      const int cj0 = lo[1] / cs, ncrj = (hi[1] - 1) / cs - cj0 + 1;
+      const int ck0 = lo[2] / cs, ncrk = (hi[2] - 1) / cs - ck0 + 1;
+      std::atomic<bool> ok(true);
+      parallel_for(0, ncri * ncrj * ncrk, [&](int n) {
+         int ci = ci0 + n % ncri, cj = cj0 + n / ncri % ncrj, ck = ck0 + n / (ncri * ncrj);
+         if (!read_chunk(ci, cj, ck, lo, hi, phi)) ok = false;
+      });
+      return ok;
+   }
+
+   bool read(Array3f& phi) const {
+      return read_region(Vec3i(0, 0, 0), Vec3i(h.ni, h.nj, h.nk), phi);
+   }
+
+   // map the whole file copy-on-write (so it can be written to without changing the
+   // file); the samples of a dense file are at (char*)map + header().data_offset.
+   // Returns null on failure; unmap with munmap(map, mapped_bytes()).
+   void* map() const {
+      if (fd < 0) return nullptr;
+      void* p = mmap(nullptr, file_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      return p == MAP_FAILED ? nullptr : p;
+   }
+   size_t mapped_bytes() const { return file_bytes; }
+
+private:
+   int fd;
+   SdfHeader h;
+   uint64_t file_bytes;
+   std::vector<uint64_t> table;
+
+   SdfFile(const SdfFile&);
+   SdfFile& operator=(const SdfFile&);
+
+   // read chunk (ci,cj,ck) and copy its part of the region [lo, hi) into phi
+   bool read_chunk(int ci, int cj, int ck, const Vec3i& lo, const Vec3i& hi, Array3f& phi) const {
+      const int cs = h.chunk_size;
+      size_t c = ci + (size_t)h.chunks_i() * (cj + (size_t)h.chunks_j() * ck);
+      int i0, i1, j0, j1, k0, k1;
+      sdf_chunk_range(ci, cs, h.ni, i0, i1);
+      sdf_chunk_range(cj, cs, h.nj, j0, j1);
+      sdf_chunk_range(ck, cs, h.nk, k0, k1);
+      std::vector<float> chunk((size_t)(i1 - i0) * (j1 - j0) * (k1 - k0));
+      uint64_t offset = table[2 * c], bytes = table[2 * c + 1];
+      if (h.codec == sdf_codec_delta) {
+         if (bytes == 0) {
+            uint32_t bits = (uint32_t)offset;
+            float value;
+            std::memcpy(&value, &bits, 4);
+            std::fill(chunk.begin(), chunk.end(), value);
+         } else {
+            std::vector<unsigned char> payload(bytes);
+            if (!sdf_detail::read_all(fd, &payload[0], bytes, offset) ||
+                !decode_sdf_chunk(&payload[0], bytes, i1 - i0, &chunk[0], chunk.size()))
+               return false;
+         }
+      } else if (bytes != chunk.size() * sizeof(float) ||
+                 !sdf_detail::read_all(fd, &chunk[0], bytes, offset)) {
+         return false;
+      }
+      for (int k = max(k0, lo[2]); k < min(k1, hi[2]); ++k)
+         for (int j = max(j0, lo[1]); j < min(j1, hi[1]); ++j)
+            for (int i = max(i0, lo[0]); i < min(i1, hi[0]); ++i)
+               phi(i - lo[0], j - lo[1], k - lo[2]) =
+                  chunk[(i - i0) + (size_t)(i1 - i0) * ((j - j0) + (size_t)(j1 - j0) * (k - k0))];
+      return true;
+   }
+
+   bool valid(uint64_t size) {
+      if (std::memcmp(h.magic, "MESH2SDF", 8) != 0 || h.version < 1 || h.version > sdf_format_version)
+         return false;
+      if (h.dtype != sdf_float32 || h.ni <= 0 || h.nj <= 0 || h.nk <= 0) return false;
+      if (h.codec > sdf_codec_delta || (h.codec != sdf_codec_none && h.chunk_size == 0)) return false;
+      if (h.data_offset % 64 != 0 || h.data_offset + h.data_bytes > size) return false;
+      uint64_t samples = (uint64_t)h.ni * h.nj * h.nk;
+      if (h.chunk_size == 0) return h.data_bytes == samples * h.sample_bytes();
+      if (h.chunk_count != (uint64_t)h.chunks_i() * h.chunks_j() * h.chunks_k()) return false;
+      table.resize(2 * (size_t)h.chunk_count);
+      if (!sdf_detail::read_all(fd, &table[0], table.size() * sizeof(uint64_t), h.chunk_table_offset))
+         return false;
+      for (uint32_t c = 0; c < h.chunk_count; ++c) {
+         bool elided = h.codec == sdf_codec_delta && table[2 * c + 1] == 0;
+         if (!elided && table[2 * c] + table[2 * c + 1] > size) return false;
+      }
+      return true;
+   }
+};
+
+#endif // SDF_FILE_H
@@ -1 +1,3 @@
 from .compute import compute
+from .core import compute_from_file
+from .sdffile import load_sdf, read_sdf_header
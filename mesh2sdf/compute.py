@@ -7,7 +7,9 @@ import mesh2sdf.core
 
 
 def compute(vertices: np.ndarray, faces: np.ndarray, size: int = 128,
-            fix: bool = False, level: float = 0.015, return_mesh: bool = False, new_fix = True):
+            fix: bool = False, level: float = 0.015, return_mesh: bool = False, new_fix = True,
+            cache_dir: str = None, dtype: str = 'float32', truncation: float = None,
+            scale: float = None):
   r''' Converts a input mesh to signed distance field (SDF).
 
   Args:
@@ -20,17 +22,25 @@ def compute(vertices: np.ndarray, faces: np.ndarray, size: int = 128,
         with a default value of 0.015 (as a reference 2/128 = 0.015625). And the
         recommended default value is 2/size.
     return_mesh (bool): If True, also return the fixed mesh.
+    cache_dir (str): If given, the SDFs computed by the core are cached in this
+        directory and reused when the same mesh and settings come again.
+    dtype (str): The type of the returned SDF, 'float32', 'float16', 'int16' or
+        'int8'; see :func:`mesh2sdf.core.compute` for how `truncation` and
+        `scale` map distances to it. The SDF computed to fix the mesh stays
+        float32.
   '''
   print("Process PID:", os.getpid())
 
   # compute sdf
-  sdf = mesh2sdf.core.compute(vertices, faces, size)
+  # NOTE: the negative value is not reliable if the mesh is not watertight, so
+  # only the unsigned distance is computed when the mesh is to be fixed
+  output = {} if fix else dict(dtype=dtype, truncation=truncation, scale=scale)
+  sdf = mesh2sdf.core.compute(vertices, faces, size, unsigned=fix, cache_dir=cache_dir,
+                              **output)
   if not fix:
     return (sdf, trimesh.Trimesh(vertices, faces)) if return_mesh else sdf
 
   print(f"SDF array memory size: {sdf.nbytes / (1024 ** 2):.2f} MB")
-  # NOTE: the negative value is not reliable if the mesh is not watertight
-  sdf = np.abs(sdf)
   vertices, faces, _, _ = skimage.measure.marching_cubes(sdf, level)
 
   # keep the max component of the extracted mesh
@@ -69,5 +79,6 @@ def compute(vertices: np.ndarray, faces: np.ndarray, size: int = 128,
   mesh.vertices = ((mesh.vertices) * (2.0 / (size - 1)) - 1.0)  # normalize it to [-1, 1]
 
   # re-compute sdf
-  sdf = mesh2sdf.core.compute(mesh.vertices, mesh.faces, size)
+  sdf = mesh2sdf.core.compute(mesh.vertices, mesh.faces, size, cache_dir=cache_dir,
+                              dtype=dtype, truncation=truncation, scale=scale)
   return (sdf, mesh) if return_mesh else sdf
@@ -0,0 +1,145 @@
+import numpy as np
+
+
+# the 128-byte header of a .sdf file, see csrc/sdffile.h
+_HEADER = np.dtype([
+    ('magic', 'S8'), ('version', '<u4'), ('dtype', '<u4'),
+    ('dims', '<i4', 3), ('sign_method', '<u4'),
+    ('origin', '<f8', 3), ('dx', '<f8'), ('mesh_hash', '<u8', 2),
+    ('chunk_size', '<u4'), ('chunk_count', '<u4'),
+    ('chunk_table_offset', '<u8'), ('data_offset', '<u8'),
+    ('data_bytes', '<u8'), ('codec', '<u4'), ('tolerance', '<f4'),
+    ('reserved', 'V8')])
+assert _HEADER.itemsize == 128
+
+_DTYPES = {0: np.dtype('<f4')}
+SIGN_METHODS = {0: 'unsigned', 1: 'parity', 2: 'fixed'}
+CODECS = {0: None, 1: 'delta'}
+
+
+def read_sdf_header(filename: str):
+  r''' Reads the header of a .sdf file written by the native code.
+
+  Returns:
+    dict: With the keys `shape`, `origin`, `dx`, `dtype`, `sign_method`,
+    `mesh_hash`, `chunk_size` (0 if the samples are one dense array), `codec`
+    (None or 'delta') with its `tolerance`, and the layout fields
+    `data_offset`, `chunk_table_offset` and `chunk_count`.
+  '''
+  raw = np.fromfile(filename, dtype=_HEADER, count=1)
+  if len(raw) != 1 or raw['magic'][0] != b'MESH2SDF':
+    raise ValueError('%s is not a .sdf file' % filename)
+  h = raw[0]
+  if h['version'] not in (1, 2) or int(h['dtype']) not in _DTYPES or \
+     int(h['codec']) not in CODECS:
+    raise ValueError('unsupported .sdf version or dtype in %s' % filename)
+  return {
+      'shape': tuple(int(n) for n in h['dims']),
+      'origin': np.array(h['origin'], dtype=np.float64),
+      'dx': float(h['dx']),
+      'dtype': _DTYPES[int(h['dtype'])],
+      'sign_method': SIGN_METHODS.get(int(h['sign_method']), 'unknown'),
+      'mesh_hash': '%016x%016x' % (int(h['mesh_hash'][0]), int(h['mesh_hash'][1])),
+      'chunk_size': int(h['chunk_size']),
+      'chunk_count': int(h['chunk_count']),
+      'codec': CODECS[int(h['codec'])],
+      'tolerance': float(h['tolerance']),
+      'chunk_table_offset': int(h['chunk_table_offset']),
+      'data_offset': int(h['data_offset']),
+  }
+
+
+def _decode_chunk(payload: bytes, row_length: int, dtype):
+  r''' Decodes a chunk written by encode_sdf_chunk (csrc/sdfcodec.h), returning its
+  samples in Array3 order.
+  '''
+  kind = payload[0]
+  if kind == 0:
+    return np.frombuffer(payload, dtype=dtype, offset=1)
+  start = 5 if kind == 2 else 1
+  b = np.frombuffer(payload, dtype=np.uint8, offset=start)
+  # varints: each ends at a byte below 128, and holds 7 bits per byte, lowest first
+  ends = np.flatnonzero(b < 128)
+  starts = np.concatenate([[0], ends[:-1] + 1])
+  group = np.repeat(np.arange(len(ends)), ends - starts + 1)
+  shift = ((np.arange(len(b)) - starts[group]) * 7).astype(np.uint64)
+  u = np.bitwise_or.reduceat((b & 127).astype(np.uint64) << shift, starts)
+  d = (u >> np.uint64(1)).astype(np.int64) ^ -(u & np.uint64(1)).astype(np.int64)
+  # undo the prediction: row starts accumulate down the rows, and within a row the
+  # second differences are the prediction errors
+  d = d.reshape(-1, row_length)
+  q = np.empty_like(d)
+  q[:, 0] = np.cumsum(d[:, 0])
+  if row_length > 1:
+    q[:, 1:] = q[:, :1] + np.cumsum(np.cumsum(d[:, 1:], axis=1), axis=1)
+  q = q.ravel()
+  if kind == 2:
+    step = np.frombuffer(payload, dtype='<f4', count=1, offset=1)[0]
+    return q.astype(np.float32) * step
+  bits = q.astype(np.int32)
+  bits = np.where(bits < 0, bits ^ np.int32(0x7fffffff), bits)
+  return bits.view(dtype)
+
+
+def load_sdf(filename: str, region=None, mmap: bool = True):
+  r''' Loads a .sdf file written by the native code.
+
+  Args:
+    filename (str): The .sdf file.
+    region (tuple): If given as ((i0, j0, k0), (i1, j1, k1)), only the samples
+        [i0, i1) x [j0, j1) x [k0, k1) are read; for a chunked file, only the
+        chunks overlapping the region are touched.
+    mmap (bool): If True and the file is dense, the result is a read-only
+        np.memmap of the file (or of the region) instead of a copy in memory.
+
+  Returns:
+    tuple: (sdf, header), where header is as returned by
+    :func:`read_sdf_header` and sdf[i, j, k] is the sample at
+    header['origin'] + header['dx'] * ((i, j, k) + (i0, j0, k0)).
+  '''
+  header = read_sdf_header(filename)
+  shape = header['shape']
+  lo, hi = (0, 0, 0), shape
+  if region is not None:
+    lo, hi = tuple(region[0]), tuple(region[1])
+    if any(l < 0 or h <= l or h > n for l, h, n in zip(lo, hi, shape)):
+      raise ValueError('region must be a non-empty range of indices in the grid')
+  dtype = header['dtype']
+
+  if header['chunk_size'] == 0:
+    sdf = np.memmap(filename, dtype=dtype, mode='r', offset=header['data_offset'],
+                    shape=shape, order='F')
+    sdf = sdf[lo[0]:hi[0], lo[1]:hi[1], lo[2]:hi[2]]
+    return (sdf if mmap else np.array(sdf)), header
+
+  cs = header['chunk_size']
+  nc = [(n + cs - 1) // cs for n in shape]
+  table = np.fromfile(filename, dtype='<u8', count=2 * header['chunk_count'],
+                      offset=header['chunk_table_offset']).reshape(-1, 2)
+  sdf = np.empty([h - l for l, h in zip(lo, hi)], dtype=dtype, order='F')
+  with open(filename, 'rb') as fid:
+    for ck in range(lo[2] // cs, (hi[2] - 1) // cs + 1):
+      for cj in range(lo[1] // cs, (hi[1] - 1) // cs + 1):
+        for ci in range(lo[0] // cs, (hi[0] - 1) // cs + 1):
+          offset, nbytes = table[ci + nc[0] * (cj + nc[1] * ck)]
+          c0 = (ci * cs, cj * cs, ck * cs)
+          c1 = tuple(min(c + cs, n) for c, n in zip(c0, shape))
+          shape_c = [b - a for a, b in zip(c0, c1)]
+          if header['codec'] == 'delta' and nbytes == 0:
+            value = np.array([offset], dtype='<u8').astype('<u4').view(dtype)[0]
+            chunk = np.full(shape_c, value, dtype=dtype)
+          else:
+            fid.seek(int(offset))
+            payload = fid.read(int(nbytes))
+            if header['codec'] == 'delta':
+              chunk = _decode_chunk(payload, shape_c[0], dtype)
+            else:
+              chunk = np.frombuffer(payload, dtype=dtype)
+            chunk = chunk.reshape(shape_c, order='F')
+          s0 = [max(a, l) for a, l in zip(c0, lo)]
+          s1 = [min(b, h) for b, h in zip(c1, hi)]
+          sdf[s0[0] - lo[0]:s1[0] - lo[0], s0[1] - lo[1]:s1[1] - lo[1],
+              s0[2] - lo[2]:s1[2] - lo[2]] = \
+              chunk[s0[0] - c0[0]:s1[0] - c0[0], s0[1] - c0[1]:s1[1] - c0[1],
+                    s0[2] - c0[2]:s1[2] - c0[2]]
+  return sdf, header
@@ -13,6 +13,7 @@ ext_modules = [
         'mesh2sdf.core',
         ['csrc/pybind.cpp', 'csrc/makelevelset3.cpp'],
         include_dirs=['csrc'],
+        cxx_std=17,  # std::from_chars in the mesh loaders
         define_macros=[('VERSION_INFO', __version__)],),
 ]
 
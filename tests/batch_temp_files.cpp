@@ -0,0 +1,82 @@
+// Runs a small batch and checks that it leaves no backing files of the grids behind in
+// /data/tmp, and no temporary outputs next to the results. Exits with 1 on failure.
+
+#include "batch.h"
+
+#include <dirent.h>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+
+static std::set<std::string> list_dir(const std::string &path)
+{
+   std::set<std::string> names;
+   DIR *dir=opendir(path.c_str());
+   if(!dir) return names;
+   while(dirent *e=readdir(dir)){
+      std::string name(e->d_name);
+      if(name!="." && name!="..") names.insert(name);
+   }
+   closedir(dir);
+   return names;
+}
+
+static int failures=0;
+
+static void check(bool ok, const std::string &what)
+{
+   if(!ok){
+      std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+      ++failures;
+   }
+}
+
+int main()
+{
+   char dir_template[]="/tmp/mesh2sdf-test-XXXXXX";
+   if(!mkdtemp(dir_template)){
+      std::fprintf(stderr, "cannot create a temporary directory\n");
+      return 1;
+   }
+   std::string dir(dir_template);
+
+   // a closed octahedron, converted twice so both grids of a job are used
+   std::string mesh=dir+"/octahedron.obj";
+   FILE *f=std::fopen(mesh.c_str(), "w");
+   std::fprintf(f, "v 1 0 0\nv -1 0 0\nv 0 1 0\nv 0 -1 0\nv 0 0 1\nv 0 0 -1\n"
+                   "f 1 3 5\nf 3 2 5\nf 2 4 5\nf 4 1 5\nf 3 1 6\nf 2 3 6\nf 4 2 6\nf 1 4 6\n");
+   std::fclose(f);
+   std::string manifest=dir+"/manifest.txt";
+   f=std::fopen(manifest.c_str(), "w");
+   for(int copy=0; copy<3; ++copy)
+      std::fprintf(f, "%s\t%s/out%d.sdf\n", mesh.c_str(), dir.c_str(), copy);
+   std::fclose(f);
+
+   BatchOptions options;
+   options.manifest=manifest;
+   options.output_dir=dir;
+   options.size=32;
+   options.jobs=2;
+   options.log=std::fopen("/dev/null", "w");
+
+   std::set<std::string> before=list_dir("/data/tmp");
+   int failed=run_batch(options);
+   std::fclose(options.log);
+   std::set<std::string> after=list_dir("/data/tmp");
+
+   check(failed==0, "run_batch converted every mesh");
+   for(const std::string &name : after)
+      check(before.count(name)>0, "/data/tmp/"+name+" was left behind");
+   std::set<std::string> outputs=list_dir(dir);
+   for(int copy=0; copy<3; ++copy)
+      check(outputs.count("out"+std::to_string(copy)+".sdf")>0, "out"+std::to_string(copy)+".sdf was written");
+   for(const std::string &name : outputs){
+      check(name.size()<4 || name.compare(name.size()-4, 4, ".tmp")!=0, dir+"/"+name+" was left behind");
+      std::remove((dir+"/"+name).c_str());
+   }
+   rmdir(dir.c_str());
+
+   if(failures==0) std::printf("batch_temp_files: ok\n");
+   return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// What the level set tests share: reporting failures, a closed test mesh and brute-force
+// distances to compare against. Include after makelevelset3.cpp, whose kernels it uses.
+
+#ifndef LEVEL_SET_CHECKS_H
+#define LEVEL_SET_CHECKS_H
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+static int failures=0;
+
+static void check(bool ok, const std::string &what)
+{
+   if(!ok){
+      std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+      ++failures;
+   }
+}
+
+// a closed latitude-longitude sphere
+static void make_sphere(const Vec3f &centre, float radius, int rings, int segments,
+                        std::vector<Vec3ui> &tri, std::vector<Vec3f> &x)
+{
+   const float pi=3.14159265f;
+   unsigned int first=(unsigned int)x.size();
+   x.push_back(centre+Vec3f(0, 0, radius));
+   for(int r=1; r<rings; ++r) for(int s=0; s<segments; ++s){
+      float theta=pi*r/rings, phi=2*pi*s/segments;
+      x.push_back(centre+radius*Vec3f(std::sin(theta)*std::cos(phi), std::sin(theta)*std::sin(phi), std::cos(theta)));
+   }
+   x.push_back(centre+Vec3f(0, 0, -radius));
+   unsigned int south=(unsigned int)x.size()-1;
+   for(int s=0; s<segments; ++s){
+      unsigned int a=first+1+s, b=first+1+(s+1)%segments;
+      tri.push_back(Vec3ui(first, a, b));
+      unsigned int c=first+1+(rings-2)*segments+s, d=first+1+(rings-2)*segments+(s+1)%segments;
+      tri.push_back(Vec3ui(south, d, c));
+   }
+   for(int r=1; r<rings-1; ++r) for(int s=0; s<segments; ++s){
+      unsigned int a=first+1+(r-1)*segments+s, b=first+1+(r-1)*segments+(s+1)%segments;
+      unsigned int c=a+segments, d=b+segments;
+      tri.push_back(Vec3ui(a, c, d));
+      tri.push_back(Vec3ui(a, d, b));
+   }
+}
+
+// the distance from each cell of the grid to the closest triangle, trying every triangle
+// whose bounding box is closer than the best so far
+static void exact_distances(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                            const Vec3f &origin, float dx, int ni, int nj, int nk, Array3f &exact)
+{
+   LevelSetMesh mesh(tri, x);
+   exact.resize(ni, nj, nk);
+   for(int k=0; k<nk; ++k) for(int j=0; j<nj; ++j) for(int i=0; i<ni; ++i){
+      Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+      float d=std::numeric_limits<float>::max();
+      for(unsigned int t=0; t<tri.size(); ++t){
+         float box_d=0;
+         for(int a=0; a<3; ++a) box_d+=sqr(max(0.f, mesh.tri_box[2*t][a]-gx[a], gx[a]-mesh.tri_box[2*t+1][a]));
+         if(box_d>=d) continue;
+         unsigned int p, q, r; assign(tri[t], p, q, r);
+         d=min(d, point_triangle_distance2(gx, x[p], x[q], x[r]));
+      }
+      exact(i,j,k)=std::sqrt(d);
+   }
+}
+
+#endif
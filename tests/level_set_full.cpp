@@ -0,0 +1,155 @@
+// Checks the full grid against brute-force distances: cells within a cell of the surface
+// must get exactly the distance to the closest triangle however the grid is swept, and
+// the rest must stay close to it; unsigned distances must be the magnitudes of the signed
+// ones, and the signs must put the cells of a convex mesh inside it exactly when they are
+// behind all of its faces. The coarse-to-fine grid and updates after edits must agree
+// with the full grid near the surface. Exits with 1 on failure. Like the benchmarks, this
+// translation unit includes makelevelset3.cpp rather than linking against it.
+
+#include "makelevelset3.cpp"
+#include "level_set_checks.h"
+
+#include <random>
+
+// the largest error of phi's magnitudes against exact, in cells, within the band (where
+// the exact distance is under a cell) and elsewhere
+static void distance_errors(const Array3f &phi, const Array3f &exact, float dx,
+                            float &band_error, float &error)
+{
+   band_error=error=0;
+   for(size_t c=0; c<phi.a.size(); ++c){
+      float e=std::fabs(std::fabs(phi.a[c])-exact.a[c])/dx;
+      if(exact.a[c]<dx) band_error=max(band_error, e);
+      else error=max(error, e);
+   }
+}
+
+// whether p is on the same side of every face of a closed convex mesh as its centre
+static bool inside_convex(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                          const Vec3f &centre, const Vec3f &p)
+{
+   for(unsigned int t=0; t<tri.size(); ++t){
+      const Vec3f &a=x[tri[t][0]], &b=x[tri[t][1]], &c=x[tri[t][2]];
+      Vec3f normal=cross(b-a, c-a);
+      if(dot(normal, p-a)*dot(normal, centre-a)<=0) return false;
+   }
+   return true;
+}
+
+int main()
+{
+   // a closed sphere with slivers through it, on a grid that isn't a whole number of
+   // sweep bricks along any axis
+   std::vector<Vec3ui> tri;
+   std::vector<Vec3f> x;
+   make_sphere(Vec3f(0.1f, -0.05f, 0.f), 0.6f, 20, 40, tri, x);
+   const unsigned int sphere_vertices=(unsigned int)x.size();
+   std::mt19937 rng(5);
+   std::uniform_real_distribution<float> coordinate(-0.8f, 0.8f);
+   for(int s=0; s<12; ++s){
+      unsigned int v=(unsigned int)x.size();
+      Vec3f a(coordinate(rng), coordinate(rng), coordinate(rng)), b(coordinate(rng), coordinate(rng), coordinate(rng));
+      x.push_back(a);
+      x.push_back(b);
+      x.push_back(b+Vec3f(0.02f, -0.01f, 0.005f));
+      tri.push_back(Vec3ui(v, v+1, v+2));
+   }
+   const int ni=45, nj=38, nk=41;
+   const float dx=0.045f;
+   const Vec3f origin(-1.f, -0.85f, -0.9f);
+   Array3f exact;
+   exact_distances(tri, x, origin, dx, ni, nj, nk, exact);
+
+   for(int rounds=1; rounds<=4; rounds+=3){
+      Array3f phi;
+      make_level_set3(tri, x, origin, dx, ni, nj, nk, phi, 1, rounds);
+      float band_error, error;
+      distance_errors(phi, exact, dx, band_error, error);
+      std::string what="with "+std::to_string(rounds)+" rounds of sweeping, the grid";
+      check(band_error==0, what+" is exact in the band (off by "+std::to_string(band_error)+" cells)");
+      check(error<0.5f, what+" is within half a cell of the exact distance (off by "+std::to_string(error)+" cells)");
+   }
+
+   // the signs are applied to the same squared distances, or skipped
+   Array3f signed_phi, unsigned_phi;
+   make_level_set3(tri, x, origin, dx, ni, nj, nk, signed_phi);
+   make_level_set3(tri, x, origin, dx, ni, nj, nk, unsigned_phi, 1, 2, true);
+   bool magnitudes=true;
+   for(size_t c=0; c<signed_phi.a.size(); ++c)
+      magnitudes=magnitudes && unsigned_phi.a[c]==std::fabs(signed_phi.a[c]);
+   check(magnitudes, "unsigned distances are the magnitudes of the signed ones");
+
+   // the coarse-to-fine grid matches near the surface and interpolates the rest
+   for(int coarsening=2; coarsening<=4; coarsening+=2){
+      Array3f multires;
+      make_level_set3_multires(tri, x, origin, dx, ni, nj, nk, multires, coarsening);
+      float band_error=0, error=0;
+      for(size_t c=0; c<multires.a.size(); ++c){
+         float e=std::fabs(multires.a[c]-signed_phi.a[c])/dx;
+         if(std::fabs(signed_phi.a[c])<dx) band_error=max(band_error, e);
+         error=max(error, e);
+      }
+      std::string what="coarsened "+std::to_string(coarsening)+" times, the grid";
+      check(band_error==0, what+" matches the full grid in the band (off by "+std::to_string(band_error)+" cells)");
+      check(error<=4, what+" is within 4 cells of the full grid (off by "+std::to_string(error)+" cells)");
+   }
+
+   // two edits in a row: a patch of the sphere pushed out, then a sliver moved across it
+   {
+      Array3f updated;
+      LevelSetScratch scratch;
+      make_level_set3(tri, x, origin, dx, ni, nj, nk, updated, scratch);
+      std::vector<Vec3f> old_x=x, new_x=x;
+      for(int edit=0; edit<2; ++edit){
+         std::vector<char> moved(x.size(), 0);
+         for(unsigned int v=0; v<x.size(); ++v){
+            bool in_patch=edit==0 ? (v<sphere_vertices && new_x[v][0]>0.4f) : v>=x.size()-3;
+            if(!in_patch) continue;
+            new_x[v]+=edit==0 ? Vec3f(0.08f, 0.f, 0.f) : Vec3f(-0.15f, 0.1f, 0.05f);
+            moved[v]=1;
+         }
+         std::vector<unsigned int> changed_tri;
+         for(unsigned int t=0; t<tri.size(); ++t)
+            if(moved[tri[t][0]] || moved[tri[t][1]] || moved[tri[t][2]]) changed_tri.push_back(t);
+         update_level_set3(tri, old_x, new_x, changed_tri, origin, dx, updated, scratch);
+         old_x=new_x;
+         Array3f recomputed;
+         make_level_set3(tri, new_x, origin, dx, ni, nj, nk, recomputed);
+         float band_error=0, error=0;
+         bool same_signs=true;
+         for(size_t c=0; c<updated.a.size(); ++c){
+            float a=updated.a[c], b=recomputed.a[c];
+            if(std::fabs(b)<dx) band_error=max(band_error, std::fabs(a-b)/dx);
+            error=max(error, std::fabs(a-b)/dx);
+            if(std::fabs(b)>1e-3f*dx && (a<0)!=(b<0)) same_signs=false;
+         }
+         std::string what="after edit "+std::to_string(edit+1)+", the updated grid";
+         check(band_error==0, what+" matches a full recomputation in the band (off by "+std::to_string(band_error)+" cells)");
+         check(error<0.5f, what+" is within half a cell of a full recomputation (off by "+std::to_string(error)+" cells)");
+         check(same_signs, what+" has the signs of a full recomputation");
+      }
+   }
+
+   // signs of the sphere alone (the slivers aren't closed), on rows of several parity
+   // words, the last of them partial
+   std::vector<Vec3ui> sphere_tri;
+   std::vector<Vec3f> sphere_x;
+   const Vec3f centre(0.1f, -0.05f, 0.f);
+   make_sphere(centre, 0.6f, 20, 40, sphere_tri, sphere_x);
+   const int rows_ni=150, rows_nj=24, rows_nk=24;
+   const float rows_dx=0.012f;
+   const Vec3f rows_origin(-1.f, -0.2f, -0.15f);
+   Array3f phi;
+   make_level_set3(sphere_tri, sphere_x, rows_origin, rows_dx, rows_ni, rows_nj, rows_nk, phi);
+   int wrong_signs=0;
+   for(int k=0; k<rows_nk; ++k) for(int j=0; j<rows_nj; ++j) for(int i=0; i<rows_ni; ++i){
+      // cells on the surface may go either way
+      if(std::fabs(phi(i,j,k))<1e-4f*rows_dx) continue;
+      Vec3f gx(i*rows_dx+rows_origin[0], j*rows_dx+rows_origin[1], k*rows_dx+rows_origin[2]);
+      if((phi(i,j,k)<0)!=inside_convex(sphere_tri, sphere_x, centre, gx)) ++wrong_signs;
+   }
+   check(wrong_signs==0, std::to_string(wrong_signs)+" cells have the wrong sign");
+
+   if(failures==0) std::printf("level_set_full: ok\n");
+   return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+// Checks regions of interest against the full grid they are part of, including slices one
+// to three cells thick along each axis, and a grid one cell thick fitted to a flat mesh:
+// in the band around the surface they must agree with the full grid, and everywhere they
+// must be as close to the exact distance as sweeping gets. A preprocessed LevelSetMesh
+// must give the same grids as the mesh itself. Exits with 1 on failure. The
+// exact distances use the kernels' own point_triangle_distance2, so like the benchmarks
+// this translation unit includes makelevelset3.cpp rather than linking against it.
+
+#include "makelevelset3.cpp"
+#include "level_set_checks.h"
+
+// compare an ROI with the cells of the full grid (and the exact distances) it covers
+static void check_roi(const Array3f &roi, const Array3f &full, const Array3f &exact,
+                      const Vec3i &roi_min, float dx, const std::string &what)
+{
+   float band_error=0, error=0;
+   bool same_signs=true;
+   for(int k=0; k<roi.nk; ++k) for(int j=0; j<roi.nj; ++j) for(int i=0; i<roi.ni; ++i){
+      float a=roi(i,j,k), b=full(i+roi_min[0], j+roi_min[1], k+roi_min[2]);
+      float e=exact(i+roi_min[0], j+roi_min[1], k+roi_min[2]);
+      if(std::fabs(b)<dx) band_error=max(band_error, std::fabs(a-b)/dx);
+      error=max(error, std::fabs(std::fabs(a)-e)/dx);
+      // cells on the surface may go either way
+      if(std::fabs(b)>1e-3f*dx && (a<0)!=(b<0)) same_signs=false;
+   }
+   check(band_error<1e-4f, what+" matches the full grid in the band (off by "+std::to_string(band_error)+" cells)");
+   check(error<0.5f, what+" is within half a cell of the exact distance (off by "+std::to_string(error)+" cells)");
+   check(same_signs, what+" has the signs of the full grid");
+}
+
+int main()
+{
+   // two spheres, one partly outside the grid, so ROIs see triangles beyond their faces
+   std::vector<Vec3ui> tri;
+   std::vector<Vec3f> x;
+   make_sphere(Vec3f(-0.2f, 0.1f, 0.f), 0.6f, 24, 48, tri, x);
+   make_sphere(Vec3f(0.75f, -0.6f, 0.5f), 0.45f, 16, 32, tri, x);
+   LevelSetMesh mesh(tri, x);
+   const int n=40;
+   const float dx=2.f/n;
+   const Vec3f origin(-1.f, -1.f, -1.f);
+   Array3f full;
+   LevelSetScratch scratch;
+   make_level_set3(tri, x, origin, dx, n, n, n, full, scratch);
+   Array3f full_from_mesh;
+   make_level_set3(mesh, origin, dx, n, n, n, full_from_mesh, scratch);
+   check(full_from_mesh.a==full.a, "the full grid is the same computed from the mesh or its preprocessing");
+   Array3f exact;
+   exact_distances(tri, x, origin, dx, n, n, n, exact);
+
+   const char *axis_name="ijk";
+   for(int axis=0; axis<3; ++axis) for(int thickness=1; thickness<=3; ++thickness)
+      for(int first=0; first+thickness<=n; first+=13){
+         Vec3i roi_min(0, 0, 0), roi_max(n, n, n);
+         roi_min[axis]=first;
+         roi_max[axis]=first+thickness;
+         Array3f roi;
+         make_level_set3(mesh, origin, dx, roi_min, roi_max, roi, scratch);
+         std::string what=std::string("slice ")+axis_name[axis]+"="+std::to_string(first)+
+                          " of "+std::to_string(thickness)+" cells";
+         check_roi(roi, full, exact, roi_min, dx, what);
+         Array3f plain;
+         make_level_set3(tri, x, origin, dx, roi_min, roi_max, plain, 1, 2, axis==1);
+         make_level_set3(mesh, origin, dx, roi_min, roi_max, roi, scratch, 1, 2, axis==1);
+         check(plain.a==roi.a, what+" is the same computed from the mesh or its preprocessing");
+      }
+
+   // a box in the middle, and one in a corner
+   Vec3i boxes[2][2]={{Vec3i(9, 12, 7), Vec3i(31, 27, 33)}, {Vec3i(0, 0, 0), Vec3i(6, 5, 7)}};
+   for(int b=0; b<2; ++b){
+      Array3f roi;
+      make_level_set3(mesh, origin, dx, boxes[b][0], boxes[b][1], roi, scratch);
+      check_roi(roi, full, exact, boxes[b][0], dx, "box ROI "+std::to_string(b));
+   }
+
+   // a square in the plane z=0, fitted without padding, so the grid is one cell thick
+   std::vector<Vec3ui> flat_tri;
+   std::vector<Vec3f> flat_x;
+   flat_x.push_back(Vec3f(-0.5f, -0.5f, 0.f));
+   flat_x.push_back(Vec3f(0.5f, -0.5f, 0.f));
+   flat_x.push_back(Vec3f(0.5f, 0.5f, 0.f));
+   flat_x.push_back(Vec3f(-0.5f, 0.5f, 0.f));
+   flat_tri.push_back(Vec3ui(0, 1, 2));
+   flat_tri.push_back(Vec3ui(0, 2, 3));
+   int flat_nk=padded_grid_samples(0.f, dx, 0);
+   check(flat_nk==1, "a flat mesh is fitted with a single layer");
+   Array3f flat;
+   make_level_set3(flat_tri, flat_x, Vec3f(-1.f, -1.f, 0.f), dx, n, n, flat_nk, flat, 1, 2, true);
+   float worst=0;
+   for(int j=0; j<n; ++j) for(int i=0; i<n; ++i){
+      float px=-1.f+i*dx, py=-1.f+j*dx;
+      float exact=std::sqrt(sqr(max(std::fabs(px)-0.5f, 0.f))+sqr(max(std::fabs(py)-0.5f, 0.f)));
+      worst=max(worst, std::fabs(flat(i,j,0)-exact)/dx);
+   }
+   check(worst<1e-4f, "the single layer fitted to a flat mesh is swept (off by "+std::to_string(worst)+" cells)");
+
+   if(failures==0) std::printf("level_set_roi: ok\n");
+   return failures==0 ? 0 : 1;
+}
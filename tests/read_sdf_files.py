@@ -0,0 +1,72 @@
+# Reads the .sdf files written by tests/sdf_files.cpp with mesh2sdf/sdffile.py and checks
+# them against the samples and headers the native reader found, in full and by region.
+# Exits with 1 on failure, and with 77 (skipped) if numpy is missing.
+#
+# usage: python read_sdf_files.py <directory written by mesh2sdf-test-sdf>
+
+import importlib.util
+import os
+import sys
+
+try:
+  import numpy as np
+except ImportError:
+  print('numpy is not installed, skipping the Python reader')
+  sys.exit(77)
+
+# loaded by path, so the package (and its native module) needn't be built
+_spec = importlib.util.spec_from_file_location(
+    'sdffile', os.path.join(os.path.dirname(os.path.abspath(__file__)), '..',
+                            'mesh2sdf', 'sdffile.py'))
+sdffile = importlib.util.module_from_spec(_spec)
+_spec.loader.exec_module(sdffile)
+
+CODECS = {0: None, 1: 'delta'}
+
+
+def check_file(directory, name):
+  failures = []
+  with open(os.path.join(directory, name + '.header')) as f:
+    fields = f.read().split()
+  shape = tuple(int(n) for n in fields[0:3])
+  expected = np.fromfile(os.path.join(directory, name + '.expected'), dtype='<f4')
+  expected = expected.reshape(shape, order='F')
+
+  for mmap in (True, False):
+    sdf, header = sdffile.load_sdf(os.path.join(directory, name + '.sdf'), mmap=mmap)
+    if header['shape'] != shape:
+      failures.append('shape %s, not %s' % (header['shape'], shape))
+    if list(header['origin']) != [float(v) for v in fields[3:6]] or \
+       header['dx'] != float(fields[6]):
+      failures.append('origin %s and dx %r' % (header['origin'], header['dx']))
+    if header['mesh_hash'] != fields[7] or header['sign_method'] != 'parity':
+      failures.append('mesh hash %s, sign method %s' %
+                      (header['mesh_hash'], header['sign_method']))
+    if header['chunk_size'] != int(fields[8]) or \
+       header['codec'] != CODECS[int(fields[9])] or \
+       header['tolerance'] != np.float32(fields[10]):
+      failures.append('chunk size %d, codec %s, tolerance %r' %
+                      (header['chunk_size'], header['codec'], header['tolerance']))
+    if sdf.shape != shape or not np.array_equal(np.asarray(sdf), expected):
+      failures.append('samples differ (mmap=%s)' % mmap)
+
+  lo, hi = (3, 9, 5), (30, 17, 26)
+  region, _ = sdffile.load_sdf(os.path.join(directory, name + '.sdf'), region=(lo, hi))
+  if not np.array_equal(np.asarray(region),
+                        expected[lo[0]:hi[0], lo[1]:hi[1], lo[2]:hi[2]]):
+    failures.append('region samples differ')
+  return ['%s.sdf: %s' % (name, f) for f in failures]
+
+
+def main():
+  directory = sys.argv[1]
+  failures = []
+  for name in ('dense', 'chunked', 'lossless', 'lossy'):
+    failures += check_file(directory, name)
+  for f in failures:
+    print('FAILED: ' + f, file=sys.stderr)
+  sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+  main()
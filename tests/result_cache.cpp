@@ -0,0 +1,97 @@
+// Stores a computed grid in a ResultCache and checks that it comes back bit for bit with
+// its header, that writing to a hit doesn't change the entry, and that the key of a
+// different mesh misses. Exits with 1 on failure.
+
+#include "makelevelset3.h"
+#include "resultcache.h"
+
+#include <dirent.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static int failures=0;
+
+static void check(bool ok, const std::string &what)
+{
+   if(!ok){
+      std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+      ++failures;
+   }
+}
+
+int main()
+{
+   char dir_template[]="/tmp/mesh2sdf-test-XXXXXX";
+   if(!mkdtemp(dir_template)){
+      std::fprintf(stderr, "cannot create a temporary directory\n");
+      return 1;
+   }
+   std::string dir(dir_template);
+
+   // a closed octahedron, on a grid that isn't a cube
+   std::vector<Vec3f> x;
+   std::vector<Vec3ui> tri;
+   x.push_back(Vec3f(1, 0, 0)); x.push_back(Vec3f(-1, 0, 0));
+   x.push_back(Vec3f(0, 1, 0)); x.push_back(Vec3f(0, -1, 0));
+   x.push_back(Vec3f(0, 0, 1)); x.push_back(Vec3f(0, 0, -1));
+   tri.push_back(Vec3ui(0, 2, 4)); tri.push_back(Vec3ui(2, 1, 4));
+   tri.push_back(Vec3ui(1, 3, 4)); tri.push_back(Vec3ui(3, 0, 4));
+   tri.push_back(Vec3ui(2, 0, 5)); tri.push_back(Vec3ui(1, 2, 5));
+   tri.push_back(Vec3ui(3, 1, 5)); tri.push_back(Vec3ui(0, 3, 5));
+   const Vec3f origin(-1.25f, -1.2f, -1.3f);
+   const float dx=0.1f;
+   Array3f phi;
+   make_level_set3(tri, x, origin, dx, 26, 25, 27, phi);
+
+   CacheKey mesh=mesh_key(x, tri), key=mesh;
+   key.add(dx);
+   ResultCache cache(dir);
+   check(!cache.find(key), "an empty cache misses");
+
+   SdfHeader header;
+   for(int a=0; a<3; ++a) header.origin[a]=origin[a];
+   header.dx=dx;
+   header.sign_method=sdf_parity;
+   header.mesh_hash[0]=mesh.h0;
+   header.mesh_hash[1]=mesh.h1;
+   check(cache.store(key, phi, header), "the grid is stored");
+
+   std::unique_ptr<CachedGrid> hit=cache.find(key);
+   check(hit!=nullptr, "the stored grid is found");
+   if(hit){
+      const SdfHeader &h=hit->header;
+      check(h.ni==phi.ni && h.nj==phi.nj && h.nk==phi.nk, "the hit has the grid's dimensions");
+      check(h.origin[0]==origin[0] && h.origin[1]==origin[1] && h.origin[2]==origin[2] && h.dx==dx,
+            "the hit has the grid's origin and dx");
+      check(h.sign_method==sdf_parity && h.mesh_hash[0]==mesh.h0 && h.mesh_hash[1]==mesh.h1,
+            "the hit has the sign method and mesh hash");
+      check(std::memcmp(hit->data, phi.a.data, phi.a.size()*sizeof(float))==0, "the hit has the grid's samples");
+      // a hit is mapped copy-on-write, so it can be handed out and modified
+      hit->data[0]=-1234.f;
+      std::unique_ptr<CachedGrid> again=cache.find(key);
+      check(again && again->data[0]==phi.a[0], "writing to a hit leaves the entry as it was");
+   }
+
+   std::vector<Vec3f> moved=x;
+   moved[4][2]=1.1f;
+   CacheKey other=mesh_key(moved, tri);
+   other.add(dx);
+   check(!cache.find(other), "the key of a different mesh misses");
+
+   DIR *d=opendir(dir.c_str());
+   int entries=0;
+   while(dirent *e=d ? readdir(d) : 0){
+      std::string name(e->d_name);
+      if(name=="." || name=="..") continue;
+      ++entries;
+      check(name==key.str()+".sdf", dir+"/"+name+" is the entry, not a temporary file");
+      std::remove((dir+"/"+name).c_str());
+   }
+   if(d) closedir(d);
+   check(entries==1, "the cache holds one entry");
+   rmdir(dir.c_str());
+
+   if(failures==0) std::printf("result_cache: ok\n");
+   return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+// Writes a grid as dense, chunked and compressed .sdf files and checks that the native
+// reader gets the samples and header back. If given a Python interpreter and
+// tests/read_sdf_files.py, also checks that mesh2sdf/sdffile.py reads the same files to
+// the same samples and header; that script exits with 77 (skipped) without numpy.
+// Exits with 1 on failure.
+//
+// usage: mesh2sdf-test-sdf [<python> <read_sdf_files.py>]
+
+#include "makelevelset3.h"
+#include "sdffile.h"
+
+#include <dirent.h>
+#include <sys/wait.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static int failures=0;
+
+static void check(bool ok, const std::string &what)
+{
+   if(!ok){
+      std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+      ++failures;
+   }
+}
+
+struct SdfVariant
+{
+   const char *name;
+   uint32_t chunk_size, codec;
+   float tolerance, exact_distance;
+};
+
+int main(int argc, char **argv)
+{
+   char dir_template[]="/tmp/mesh2sdf-test-XXXXXX";
+   if(!mkdtemp(dir_template)){
+      std::fprintf(stderr, "cannot create a temporary directory\n");
+      return 1;
+   }
+   std::string dir(dir_template);
+
+   // a truncated octahedron field, so chunks far from the surface are constant, on a grid
+   // that isn't a whole number of chunks along any axis
+   std::vector<Vec3f> x;
+   std::vector<Vec3ui> tri;
+   x.push_back(Vec3f(1, 0, 0)); x.push_back(Vec3f(-1, 0, 0));
+   x.push_back(Vec3f(0, 1, 0)); x.push_back(Vec3f(0, -1, 0));
+   x.push_back(Vec3f(0, 0, 1)); x.push_back(Vec3f(0, 0, -1));
+   tri.push_back(Vec3ui(0, 2, 4)); tri.push_back(Vec3ui(2, 1, 4));
+   tri.push_back(Vec3ui(1, 3, 4)); tri.push_back(Vec3ui(3, 0, 4));
+   tri.push_back(Vec3ui(2, 0, 5)); tri.push_back(Vec3ui(1, 2, 5));
+   tri.push_back(Vec3ui(3, 1, 5)); tri.push_back(Vec3ui(0, 3, 5));
+   const float truncation=0.25f;
+   Array3f phi;
+   make_level_set3(tri, x, Vec3f(-1.7f, -1.6f, -1.5f), 0.1f, 35, 33, 30, phi, 1, 2, false, truncation);
+   for(size_t c=0; c<phi.a.size(); ++c) phi.a[c]=clamp(phi.a[c], -truncation, truncation);
+
+   const SdfVariant variants[]={
+      {"dense", 0, sdf_codec_none, 0, 0},
+      {"chunked", 8, sdf_codec_none, 0, 0},
+      {"lossless", 8, sdf_codec_delta, 0, 0},
+      {"lossy", 8, sdf_codec_delta, 1e-3f, 0.05f}
+   };
+   for(const SdfVariant &v : variants){
+      std::string path=dir+"/"+v.name+".sdf";
+      SdfHeader header;
+      header.origin[0]=-1.7; header.origin[1]=-1.6; header.origin[2]=-1.5;
+      header.dx=0.1;
+      header.sign_method=sdf_parity;
+      header.mesh_hash[0]=0x0123456789abcdefull;
+      header.mesh_hash[1]=0xfedcba9876543210ull;
+      header.chunk_size=v.chunk_size;
+      header.codec=v.codec;
+      header.tolerance=v.tolerance;
+      SdfWriteStats stats;
+      check(write_sdf(path, phi, header, v.exact_distance, &stats), path+" is written");
+      if(v.codec==sdf_codec_delta){
+         check(stats.elided_chunks>0, path+" has elided chunks");
+         check((stats.quantized_chunks>0)==(v.tolerance>0), path+" has quantized chunks if lossy");
+      }
+
+      SdfFile file;
+      check(file.open(path), path+" is opened");
+      const SdfHeader &h=file.header();
+      check(h.ni==phi.ni && h.nj==phi.nj && h.nk==phi.nk && h.dx==0.1 && h.origin[1]==-1.6,
+            path+" has the grid's dimensions, origin and dx");
+      check(h.mesh_hash[0]==header.mesh_hash[0] && h.mesh_hash[1]==header.mesh_hash[1] &&
+            h.sign_method==sdf_parity && h.chunk_size==v.chunk_size && h.codec==v.codec,
+            path+" has the mesh hash, sign method, chunk size and codec");
+      Array3f read;
+      check(file.read(read), path+" is read");
+      float error=0;
+      bool near_exact=true;
+      for(size_t c=0; c<phi.a.size() && c<read.a.size(); ++c){
+         error=max(error, std::fabs(read.a[c]-phi.a[c]));
+         if(std::fabs(phi.a[c])<v.exact_distance && read.a[c]!=phi.a[c]) near_exact=false;
+      }
+      check(read.a.size()==phi.a.size() && error<=v.tolerance, path+" reads back within its tolerance");
+      check(near_exact, path+" reads back exactly near the surface");
+      Array3f region;
+      Vec3i lo(3, 9, 5), hi(30, 17, 26);
+      check(file.read_region(lo, hi, region), path+" has a region read");
+      bool same_region=true;
+      for(int k=lo[2]; k<hi[2]; ++k) for(int j=lo[1]; j<hi[1]; ++j) for(int i=lo[0]; i<hi[0]; ++i)
+         same_region=same_region && region(i-lo[0], j-lo[1], k-lo[2])==read(i,j,k);
+      check(same_region, path+" reads a region as the whole file has it");
+
+      // what the Python reader must find: the samples as read here, and the header
+      std::string expected=dir+"/"+v.name+".expected";
+      FILE *f=std::fopen(expected.c_str(), "wb");
+      std::fwrite(read.a.data, sizeof(float), read.a.size(), f);
+      std::fclose(f);
+      f=std::fopen((dir+"/"+v.name+".header").c_str(), "w");
+      std::fprintf(f, "%d %d %d %.17g %.17g %.17g %.17g %016llx%016llx %u %u %.9g\n",
+                   h.ni, h.nj, h.nk, h.origin[0], h.origin[1], h.origin[2], h.dx,
+                   (unsigned long long)h.mesh_hash[0], (unsigned long long)h.mesh_hash[1],
+                   h.chunk_size, h.codec, h.tolerance);
+      std::fclose(f);
+   }
+
+   int python_status=0;
+   if(argc>=3){
+      std::string command=std::string("\"")+argv[1]+"\" \""+argv[2]+"\" \""+dir+"\"";
+      int status=std::system(command.c_str());
+      python_status=WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+      check(python_status==0 || python_status==77, "mesh2sdf/sdffile.py reads the files as written");
+   }
+
+   if(DIR *d=opendir(dir.c_str())){
+      while(dirent *e=readdir(d)){
+         std::string name(e->d_name);
+         if(name!="." && name!="..") std::remove((dir+"/"+name).c_str());
+      }
+      closedir(d);
+   }
+   rmdir(dir.c_str());
+
+   if(failures>0) return 1;
+   std::printf(python_status==77 ? "sdf_files: ok (Python reader skipped)\n" : "sdf_files: ok\n");
+   return python_status;
+}